@@ -0,0 +1,184 @@
+#ifndef CHUNKED_APPEND_BUFFER_H
+#define CHUNKED_APPEND_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Append buffer storing its data in fixed size chunks, allocated from a
+// memory resource and never moved or copied once written. Appending never
+// reallocates the existing data (no latency spikes on growth), and pointers
+// into the buffer stay valid for its whole lifetime.
+//
+// Every appended range is stored contiguously in a single chunk (a range
+// longer than ChunkSize gets a dedicated chunk), so a piece never crosses
+// a chunk boundary. Offsets are logical - between two chunks there is a gap
+// of one unused offset, so even a piece ending exactly at the end of a chunk
+// is never considered continued by the next chunk (see piece coalescing).
+template <typename CharT, std::size_t ChunkSize = 64 * 1024>
+class ChunkedAppendBuffer {
+    static_assert(std::is_trivially_copyable_v<CharT>);
+
+  public:
+    using value_type = CharT;
+    using size_type = std::size_t;
+
+    static constexpr size_type chunk_size = ChunkSize;
+    // appended data never moves, see StableStorage
+    static constexpr bool stable_storage = true;
+
+    explicit ChunkedAppendBuffer(
+            std::pmr::memory_resource* resource
+                = std::pmr::get_default_resource())
+        : chunks_{resource} {}
+
+    ChunkedAppendBuffer(const ChunkedAppendBuffer& other)
+        : chunks_{other.chunks_.get_allocator()} {
+        copy_chunks_from(other);
+    }
+
+    ChunkedAppendBuffer(ChunkedAppendBuffer&& other) noexcept
+        : chunks_{std::move(other.chunks_)} {
+        other.chunks_.clear();
+    }
+
+    // Assignments keep the memory resource of this buffer, like std::pmr
+    // containers do
+    ChunkedAppendBuffer& operator=(const ChunkedAppendBuffer& other) {
+        if (this != &other) {
+            clear();
+            copy_chunks_from(other);
+        }
+        return *this;
+    }
+
+    ChunkedAppendBuffer& operator=(ChunkedAppendBuffer&& other) {
+        if (this != &other) {
+            clear();
+            if (*resource() == *other.resource()) {
+                chunks_.swap(other.chunks_);
+            }
+            else {
+                copy_chunks_from(other);
+                other.clear();
+            }
+        }
+        return *this;
+    }
+
+    ~ChunkedAppendBuffer() {
+        clear();
+    }
+
+    // Both buffers must use equal memory resources
+    void swap(ChunkedAppendBuffer& other) noexcept {
+        chunks_.swap(other.chunks_);
+    }
+
+    [[nodiscard]] std::pmr::memory_resource* resource() const {
+        return chunks_.get_allocator().resource();
+    }
+
+    // Logical size, including the gaps between chunks
+    [[nodiscard]] size_type size() const {
+        return chunks_.empty() ? 0 : chunks_.back().base + chunks_.back().used;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size() == 0;
+    }
+
+    // Bytes allocated for the data
+    [[nodiscard]] size_type allocated_bytes() const {
+        size_type bytes = 0;
+        for (const Chunk& chunk : chunks_) {
+            bytes += chunk.capacity * sizeof(CharT);
+        }
+        return bytes;
+    }
+
+    // Copies [first, last) into a single chunk and returns its offset
+    template <typename InputIt>
+    size_type append_piece(InputIt first, InputIt last) {
+        const auto count = static_cast<size_type>(std::distance(first, last));
+        if (count == 0) {
+            return size();
+        }
+
+        if (chunks_.empty()
+                || chunks_.back().capacity - chunks_.back().used < count) {
+            const size_type base = chunks_.empty()
+                                   ? 0
+                                   : chunks_.back().base + chunks_.back().used
+                                     + 1;
+            add_chunk(base, std::max(count, chunk_size));
+        }
+
+        Chunk& chunk = chunks_.back();
+        const size_type start = chunk.base + chunk.used;
+        std::copy(first, last, chunk.data + chunk.used);
+        chunk.used += count;
+        return start;
+    }
+
+    // Pointer to the element at offset; contiguous up to the end of the
+    // appended range containing it
+    [[nodiscard]] const CharT* data_at(size_type offset) const {
+        // the last chunk starting at or before offset
+        const auto it = std::upper_bound(
+            chunks_.begin(), chunks_.end(), offset,
+            [](size_type value, const Chunk& chunk) {
+                return value < chunk.base;
+            });
+        if (it == chunks_.begin()) {
+            return nullptr;
+        }
+        const Chunk& chunk = *std::prev(it);
+        return chunk.data + (offset - chunk.base);
+    }
+
+    void clear() {
+        for (const Chunk& chunk : chunks_) {
+            resource()->deallocate(chunk.data, chunk.capacity * sizeof(CharT),
+                                   alignof(CharT));
+        }
+        chunks_.clear();
+    }
+
+  private:
+    struct Chunk {
+        CharT* data;
+        size_type base;      // logical offset of data[0]
+        size_type capacity;
+        size_type used;
+    };
+
+    Chunk& add_chunk(size_type base, size_type capacity) {
+        // grow the chunk list first, so pushing the new chunk can't throw
+        if (chunks_.size() == chunks_.capacity()) {
+            chunks_.reserve(std::max<size_type>(8, 2 * chunks_.capacity()));
+        }
+        auto* data = static_cast<CharT*>(resource()->allocate(
+            capacity * sizeof(CharT), alignof(CharT)));
+        chunks_.push_back({data, base, capacity, 0});
+        return chunks_.back();
+    }
+
+    // Copies the chunks with their offsets, so the pieces stay valid
+    void copy_chunks_from(const ChunkedAppendBuffer& other) {
+        chunks_.reserve(other.chunks_.size());
+        for (const Chunk& chunk : other.chunks_) {
+            Chunk& copy = add_chunk(chunk.base, chunk.capacity);
+            std::copy_n(chunk.data, chunk.used, copy.data);
+            copy.used = chunk.used;
+        }
+    }
+
+    std::pmr::vector<Chunk> chunks_;
+};
+
+#endif  // CHUNKED_APPEND_BUFFER_H
@@ -0,0 +1,360 @@
+#ifndef CONCURRENT_DOCUMENT_H
+#define CONCURRENT_DOCUMENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "chunked_append_buffer.h"
+#include "epoch_domain.h"
+#include "undo_redo_text_buffer.h"
+
+// Document edited from any number of threads at once without locks, for
+// servers hosting many documents. Edits are queued (a lock-free
+// multi-producer stack) and applied by whichever thread calls drain(), one
+// at a time, runs of them in a single apply_edits. Every drain publishes
+// a Snapshot, read without ever waiting for the writer.
+//
+//   network threads --submit()--> queue --drain()--> UndoRedoTextBuffer
+//                                                          |
+//   readers <--read()-- published Snapshot <---------------+
+//
+// Replaced snapshots are freed through an EpochDomain once no reader can
+// still see them, and with them the append buffers compaction replaced.
+// Publishing takes O(pieces) (see PieceTable::snapshot) once per drain,
+// shared by the commands it applies - with many small documents it's
+// cheap, a large document cut into many pieces pays it on every drain.
+//
+// Commands apply in submission order, each to the document as left by the
+// previous one. Undo steps follow the commands' groups: the consecutive
+// edits of a group applied by a drain are one undo step, and an undo or
+// redo of a group only reverts an operation of that group, never another
+// client's.
+template <
+    typename CharT = char,
+    typename OriginalBufferT = std::basic_string<CharT>,
+    typename PieceSequenceT = std::list<Piece>>
+class ConcurrentDocument {
+  public:
+    using text_buffer_t = UndoRedoTextBuffer<ChunkedAppendBuffer<CharT>,
+                                             OriginalBufferT,
+                                             PieceSequenceT>;
+    using value_type = CharT;
+    using size_type = std::size_t;
+    using Snapshot = typename text_buffer_t::Snapshot;
+
+    // Undo step of a command, e.g. an id per client or per user action.
+    // Edits of no_group are each an undo step of their own, an undo or redo
+    // of no_group reverts any operation.
+    using group_type = std::uint64_t;
+    static constexpr group_type no_group = 0;
+
+    struct Command {
+        enum class Kind : std::uint8_t { edit, undo, redo };
+
+        Kind kind = Kind::edit;
+        // for edits: delete_count elements at offset are replaced with text
+        size_type offset = 0;
+        size_type delete_count = 0;
+        std::basic_string<CharT> text;
+        group_type group = no_group;
+    };
+
+    // The latest published version of the document, from the time of
+    // read(). Keeps it alive, so it's meant to be short-lived.
+    class Reader {
+      public:
+        const Snapshot& operator*() const { return *snapshot_; }
+        const Snapshot* operator->() const { return snapshot_; }
+
+      private:
+        friend class ConcurrentDocument;
+
+        Reader(EpochDomain::Guard guard, const Snapshot* snapshot)
+            : guard_{std::move(guard)}, snapshot_{snapshot} {}
+
+        EpochDomain::Guard guard_;
+        const Snapshot* snapshot_;
+    };
+
+    using HistoryLimit = typename text_buffer_t::HistoryLimit;
+
+    // The domain is typically shared by all the documents
+    ConcurrentDocument(EpochDomain& domain, OriginalBufferT original_buffer,
+                       HistoryLimit history_limit = {})
+        : domain_{domain}, text_buffer_{std::move(original_buffer)} {
+        text_buffer_.set_history_limit(history_limit);
+        published_.store(new Snapshot{text_buffer_.snapshot()});
+    }
+
+    // Readers point into it
+    ConcurrentDocument(const ConcurrentDocument&) = delete;
+    ConcurrentDocument& operator=(const ConcurrentDocument&) = delete;
+
+    // With no readers and drains left
+    ~ConcurrentDocument() {
+        free_nodes(pending_.exchange(nullptr));
+        delete published_.load();
+    }
+
+    // Queues the command, from any thread. Returns true if the queue was
+    // empty, then it's up to the caller to have drain() called (e.g. by
+    // posting the document to a thread pool).
+    bool submit(Command command) {
+        auto* node = new Node{std::move(command), nullptr};
+        Node* head = pending_.load();
+        do {
+            // the node is the drainer's as soon as it's in
+            node->next = head;
+        } while (!pending_.compare_exchange_weak(head, node));
+        return head == nullptr;
+    }
+
+    bool insert_at(size_type offset, std::basic_string_view<CharT> text,
+                   group_type group = no_group) {
+        return submit({Command::Kind::edit, offset, 0,
+                       std::basic_string<CharT>{text}, group});
+    }
+
+    bool delete_range_at(size_type offset, size_type count,
+                         group_type group = no_group) {
+        return submit({Command::Kind::edit, offset, count, {}, group});
+    }
+
+    bool replace_range_at(size_type offset, size_type count,
+                          std::basic_string_view<CharT> text,
+                          group_type group = no_group) {
+        return submit({Command::Kind::edit, offset, count,
+                       std::basic_string<CharT>{text}, group});
+    }
+
+    bool undo(group_type group = no_group) {
+        return submit({Command::Kind::undo, 0, 0, {}, group});
+    }
+    bool redo(group_type group = no_group) {
+        return submit({Command::Kind::redo, 0, 0, {}, group});
+    }
+
+    // Applies the queued commands and publishes the result, from any thread.
+    // If another thread is draining already, returns right away and leaves
+    // the commands to it. Returns the number of commands applied.
+    size_type drain() {
+        size_type applied = 0;
+        while (!draining_.exchange(true)) {
+            Node* nodes = reverse(pending_.exchange(nullptr));
+            if (nodes != nullptr) {
+                applied += apply(nodes);
+                free_nodes(nodes);
+                publish();
+            }
+            reclaim();
+            draining_.store(false);
+            // commands queued while the flag was up were left to this call
+            if (pending_.load() == nullptr) {
+                break;
+            }
+        }
+        return applied;
+    }
+
+    // From any thread, never waits for drain()
+    [[nodiscard]] Reader read() const {
+        EpochDomain::Guard guard = domain_.pin();
+        return Reader{std::move(guard), published_.load()};
+    }
+
+    // Commands dropped for being out of the bounds of the document, or
+    // undos and redos with nothing of their group to undo or redo
+    [[nodiscard]] size_type rejected_count() const {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+
+    // Operations of the undo history, as of the latest drain
+    [[nodiscard]] size_type undo_count() const {
+        return undo_count_.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] size_type redo_count() const {
+        return redo_count_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Node {
+        Command command;
+        Node* next;
+    };
+
+    struct Retired {
+        EpochDomain::epoch_type epoch;
+        std::unique_ptr<const Snapshot> snapshot;
+    };
+
+    // The queue is a stack, newest first, reversed in place before applying
+    static Node* reverse(Node* nodes) {
+        Node* reversed = nullptr;
+        while (nodes != nullptr) {
+            Node* next = nodes->next;
+            nodes->next = reversed;
+            reversed = nodes;
+            nodes = next;
+        }
+        return reversed;
+    }
+
+    static void free_nodes(Node* nodes) {
+        while (nodes != nullptr) {
+            delete std::exchange(nodes, nodes->next);
+        }
+    }
+
+    // The edits of a group are a transaction, committed when a command of
+    // another group comes or the drain ends, so the history limit keeps
+    // applying. Consecutive edits, each after the text of the previous one,
+    // are rebased onto the document before them and applied as one batch.
+    size_type apply(Node* nodes) {
+        using Edit = typename text_buffer_t::Edit;
+
+        std::vector<Edit> run;
+        size_type size = text_buffer_.size();  // after the edits so far
+        size_type run_end = 0;   // end of the last edit's text, in size
+        size_type inserted = 0;  // by the run so far
+        size_type deleted = 0;
+        const auto flush = [&] {
+            if (!run.empty()) {
+                text_buffer_.apply_edits(run);
+                run.clear();
+            }
+            inserted = 0;
+            deleted = 0;
+        };
+        const auto commit = [&] {
+            flush();
+            if (in_transaction_) {
+                commit_group();
+            }
+        };
+
+        size_type applied = 0;
+        size_type rejected = 0;
+        for (Node* node = nodes; node != nullptr; node = node->next) {
+            const Command& command = node->command;
+            if (command.kind != Command::Kind::edit) {
+                commit();
+                const bool undo = command.kind == Command::Kind::undo;
+                // the operation it would revert
+                const size_type operation = text_buffer_.undo_count()
+                                            - (undo ? 1 : 0);
+                if ((undo ? text_buffer_.undo_count() == 0
+                          : text_buffer_.redo_count() == 0)
+                        || (command.group != no_group
+                            && operation_groups_[operation]
+                               != command.group)) {
+                    ++rejected;
+                    continue;
+                }
+                undo ? text_buffer_.undo() : text_buffer_.redo();
+                forget_trimmed_groups();
+                size = text_buffer_.size();
+                ++applied;
+                continue;
+            }
+
+            if (command.offset > size
+                    || command.delete_count > size - command.offset) {
+                ++rejected;
+                continue;
+            }
+            ++applied;
+            if (command.delete_count == 0 && command.text.empty()) {
+                continue;
+            }
+            if (in_transaction_ && (command.group == no_group
+                                    || command.group != open_group_)) {
+                commit();
+            }
+            if (!in_transaction_) {
+                begin_group(command.group);
+            }
+            if (!run.empty() && command.offset < run_end) {
+                flush();
+            }
+            run.push_back({command.offset + deleted - inserted,
+                           command.delete_count, command.text});
+            inserted += command.text.size();
+            deleted += command.delete_count;
+            size = size - command.delete_count + command.text.size();
+            run_end = command.offset + command.text.size();
+        }
+        commit();
+        undo_count_.store(text_buffer_.undo_count(),
+                          std::memory_order_relaxed);
+        redo_count_.store(text_buffer_.redo_count(),
+                          std::memory_order_relaxed);
+
+        rejected_.fetch_add(rejected, std::memory_order_relaxed);
+        return applied;
+    }
+
+    void begin_group(group_type group) {
+        text_buffer_.begin_transaction();
+        in_transaction_ = true;
+        open_group_ = group;
+        // the redo operations are dropped by the first edit
+        operation_groups_.resize(text_buffer_.undo_count());
+    }
+
+    void commit_group() {
+        text_buffer_.commit_transaction();
+        in_transaction_ = false;
+        operation_groups_.push_back(open_group_);
+        forget_trimmed_groups();
+    }
+
+    // The history limit forgets the oldest operations
+    void forget_trimmed_groups() {
+        while (operation_groups_.size()
+                > text_buffer_.undo_count() + text_buffer_.redo_count()) {
+            operation_groups_.pop_front();
+        }
+    }
+
+    void publish() {
+        const Snapshot* old_snapshot = published_.exchange(
+            new Snapshot{text_buffer_.snapshot()});
+        retired_.push_back({domain_.advance(),
+                            std::unique_ptr<const Snapshot>{old_snapshot}});
+    }
+
+    void reclaim() {
+        const EpochDomain::epoch_type safe = domain_.safe_epoch();
+        while (!retired_.empty() && retired_.front().epoch <= safe) {
+            retired_.pop_front();
+        }
+    }
+
+    EpochDomain& domain_;
+    text_buffer_t text_buffer_;
+    std::atomic<Node*> pending_ = nullptr;
+    std::atomic<const Snapshot*> published_ = nullptr;
+    std::atomic<bool> draining_ = false;
+    std::atomic<size_type> rejected_ = 0;
+    std::atomic<size_type> undo_count_ = 0;
+    std::atomic<size_type> redo_count_ = 0;
+
+    // written by the draining thread only:
+    // whether the edits of open_group_ are still being added to
+    bool in_transaction_ = false;
+    group_type open_group_ = no_group;
+    // group of each operation of the undo history, undo then redo ones
+    std::deque<group_type> operation_groups_;
+    // oldest first
+    std::deque<Retired> retired_;
+};
+
+#endif  // CONCURRENT_DOCUMENT_H
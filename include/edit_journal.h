@@ -0,0 +1,377 @@
+#ifndef EDIT_JOURNAL_H
+#define EDIT_JOURNAL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Append-only binary log of the operations of an UndoRedoTextBuffer, to
+// recover a session (the document and its undo history) after a crash by
+// replaying it over the same original document. Only the inserted text is
+// stored, never copies of the document.
+//
+//   journal: "PTJ" version  sizeof(CharT)  record*
+//   record:  tag  [fields]
+//
+//   insert        offset count  count elements
+//   delete        offset count
+//   edits         n  n * (offset delete_count count  count elements)
+//   clear, undo, redo, begin_transaction, commit_transaction,
+//   break_typing_burst   no fields
+//
+// Numbers are unsigned LEB128 varints (7 bits per byte, high bit set on all
+// but the last one), so small offsets and lengths take a byte or two.
+// A record is written in one go, a crash leaves at most a torn last record,
+// which replay ignores. Replay also stops at the first record that can't
+// be applied (e.g. garbage with an offset past the end of the document).
+
+namespace edit_journal {
+
+inline constexpr char magic[3] = {'P', 'T', 'J'};
+inline constexpr std::uint8_t format_version = 1;
+
+enum class Tag : std::uint8_t {
+    insert = 1,
+    delete_range,
+    edits,
+    clear,
+    undo,
+    redo,
+    begin_transaction,
+    commit_transaction,
+    break_typing_burst,
+};
+
+}  // namespace edit_journal
+
+// Mirrors the editing interface of UndoRedoTextBuffer - call it next to
+// each operation of the buffer. Records go to the stream as they come,
+// flush() (or the stream's own buffering) decides when they reach the disk.
+template <typename CharT>
+class EditJournalWriter {
+    static_assert(std::is_trivially_copyable_v<CharT>);
+
+  public:
+    using value_type = CharT;
+    using size_type = std::size_t;
+    using Tag = edit_journal::Tag;
+
+    // Starts a journal. Pass write_header = false to continue an existing
+    // one, e.g. after replaying it (see EditJournalReplay::valid_bytes).
+    explicit EditJournalWriter(std::ostream& out, bool write_header = true)
+        : out_{out} {
+        if (write_header) {
+            record_.append(edit_journal::magic, sizeof(edit_journal::magic));
+            record_.push_back(static_cast<char>(edit_journal::format_version));
+            record_.push_back(static_cast<char>(sizeof(CharT)));
+            write_record();
+        }
+    }
+
+    void insert_at(size_type idx, CharT element) {
+        insert_range_at(idx, std::basic_string_view<CharT>{&element, 1});
+    }
+
+    void insert_range_at(size_type idx, std::basic_string_view<CharT> text) {
+        put_tag(Tag::insert);
+        put_varint(idx);
+        put_text(text);
+        write_record();
+    }
+
+    void delete_range_at(size_type idx, size_type count) {
+        put_tag(Tag::delete_range);
+        put_varint(idx);
+        put_varint(count);
+        write_record();
+    }
+
+    // Edits are anything with offset, delete_count and text, e.g.
+    // UndoRedoTextBuffer::Edit
+    template <typename EditRange>
+    void apply_edits(const EditRange& edits) {
+        put_tag(Tag::edits);
+        put_varint(std::size(edits));
+        for (const auto& edit : edits) {
+            put_varint(edit.offset);
+            put_varint(edit.delete_count);
+            put_text(edit.text);
+        }
+        write_record();
+    }
+
+    void clear() { put_simple(Tag::clear); }
+    void undo() { put_simple(Tag::undo); }
+    void redo() { put_simple(Tag::redo); }
+    void begin_transaction() { put_simple(Tag::begin_transaction); }
+    void commit_transaction() { put_simple(Tag::commit_transaction); }
+    void break_typing_burst() { put_simple(Tag::break_typing_burst); }
+
+    void flush() {
+        out_.flush();
+    }
+
+  private:
+    void put_simple(Tag tag) {
+        put_tag(tag);
+        write_record();
+    }
+
+    void put_tag(Tag tag) {
+        record_.push_back(static_cast<char>(tag));
+    }
+
+    void put_varint(std::uint64_t value) {
+        while (value >= 0x80) {
+            record_.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        record_.push_back(static_cast<char>(value));
+    }
+
+    void put_text(std::basic_string_view<CharT> text) {
+        put_varint(text.size());
+        record_.append(reinterpret_cast<const char*>(text.data()),
+                       text.size() * sizeof(CharT));
+    }
+
+    // A record is assembled first and written with a single call, so
+    // the stream never holds half of one unless the process dies mid-write
+    void write_record() {
+        out_.write(record_.data(),
+                   static_cast<std::streamsize>(record_.size()));
+        record_.clear();
+    }
+
+    std::ostream& out_;
+    std::string record_;
+};
+
+// Outcome of replaying a journal
+struct EditJournalReplay {
+    std::size_t records = 0;      // operations applied
+    std::size_t valid_bytes = 0;  // length of the journal up to the last one
+    bool complete = false;        // false if a torn record was dropped
+};
+// A journal with a torn record is truncated to valid_bytes before being
+// continued, or the new records would follow the garbage.
+
+namespace edit_journal::detail {
+
+// Reads whole records from the stream, reporting a failure (a torn record
+// at the end) instead of throwing
+template <typename CharT>
+class RecordReader {
+  public:
+    explicit RecordReader(std::istream& in) : in_{in} {}
+
+    bool get_byte(std::uint8_t& byte) {
+        const auto c = in_.get();
+        if (c == std::istream::traits_type::eof()) {
+            return false;
+        }
+        byte = static_cast<std::uint8_t>(c);
+        ++position_;
+        return true;
+    }
+
+    bool get_varint(std::size_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            std::uint8_t byte;
+            if (!get_byte(byte)) {
+                return false;
+            }
+            value |= static_cast<std::size_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Read in chunks, the text grows with the data actually there, not with
+    // a length that could be garbage
+    bool get_text(std::basic_string<CharT>& text) {
+        std::size_t count;
+        if (!get_varint(count)) {
+            return false;
+        }
+        text.clear();
+        while (text.size() < count) {
+            const std::size_t start = text.size();
+            const std::size_t chunk = std::min(count - start, chunk_size);
+            text.resize(start + chunk);
+            const auto bytes = static_cast<std::streamsize>(
+                chunk * sizeof(CharT));
+            in_.read(reinterpret_cast<char*>(text.data() + start), bytes);
+            position_ += static_cast<std::size_t>(in_.gcount());
+            if (in_.gcount() != bytes) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] std::size_t position() const { return position_; }
+
+  private:
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    std::istream& in_;
+    std::size_t position_ = 0;
+};
+
+// Whether delete_count elements at offset are in a document of size
+inline bool in_bounds(std::size_t offset, std::size_t delete_count,
+                      std::size_t size) {
+    return offset <= size && delete_count <= size - offset;
+}
+
+}  // namespace edit_journal::detail
+
+// Replays the journal in in onto text_buffer, which has to hold the same
+// original document the journal was started on. Transactions a crash left
+// open are committed, so the buffer ends up editable. Throws
+// std::runtime_error if in is not a journal for CharT. Records are checked
+// against the buffer before being applied, the first invalid one is taken
+// for a torn record.
+template <typename CharT, typename TextBufferT>
+EditJournalReplay replayEditJournal(std::istream& in,
+                                    TextBufferT& text_buffer) {
+    using edit_journal::Tag;
+    using Edit = typename TextBufferT::Edit;
+
+    edit_journal::detail::RecordReader<CharT> reader{in};
+    EditJournalReplay replay;
+
+    char header[sizeof(edit_journal::magic) + 2] = {};
+    for (char& c : header) {
+        std::uint8_t byte;
+        if (!reader.get_byte(byte)) {
+            throw std::runtime_error("edit journal: truncated header");
+        }
+        c = static_cast<char>(byte);
+    }
+    if (std::string_view{header, sizeof(edit_journal::magic)}
+                != std::string_view{edit_journal::magic,
+                                    sizeof(edit_journal::magic)}
+            || header[3] != static_cast<char>(edit_journal::format_version)
+            || header[4] != static_cast<char>(sizeof(CharT))) {
+        throw std::runtime_error("edit journal: unsupported format");
+    }
+    replay.valid_bytes = reader.position();
+
+    std::size_t transaction_depth = 0;
+    std::basic_string<CharT> text;
+    std::vector<std::basic_string<CharT>> texts;
+    std::vector<Edit> edits;
+    while (true) {
+        std::uint8_t tag;
+        if (!reader.get_byte(tag)) {
+            replay.complete = true;
+            break;
+        }
+
+        bool read = true;
+        std::size_t offset = 0;
+        std::size_t count = 0;
+        const std::size_t size = text_buffer.size();
+        switch (static_cast<Tag>(tag)) {
+        case Tag::insert:
+            read = reader.get_varint(offset) && reader.get_text(text)
+                   && offset <= size;
+            if (read) {
+                text_buffer.insert_range_at(offset, text);
+            }
+            break;
+        case Tag::delete_range:
+            read = reader.get_varint(offset) && reader.get_varint(count)
+                   && edit_journal::detail::in_bounds(offset, count, size);
+            if (read) {
+                text_buffer.delete_range_at(offset, count);
+            }
+            break;
+        case Tag::edits:
+            // texts are read first, the views into them are taken once
+            // they're all in place
+            read = reader.get_varint(count);
+            edits.clear();
+            for (std::size_t i = 0; read && i < count; ++i) {
+                Edit edit{};
+                if (texts.size() == i) {
+                    texts.emplace_back();
+                }
+                read = reader.get_varint(edit.offset)
+                       && reader.get_varint(edit.delete_count)
+                       && reader.get_text(texts[i])
+                       && edit_journal::detail::in_bounds(
+                              edit.offset, edit.delete_count, size)
+                       && (i == 0 || edits.back().offset
+                                     + edits.back().delete_count
+                                     <= edit.offset);
+                edits.push_back(edit);
+            }
+            if (read) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    edits[i].text = texts[i];
+                }
+                text_buffer.apply_edits(std::span<const Edit>{edits});
+            }
+            break;
+        case Tag::clear:
+            text_buffer.clear();
+            break;
+        case Tag::undo:
+            read = transaction_depth == 0 && text_buffer.undo_count() > 0;
+            if (read) {
+                text_buffer.undo();
+            }
+            break;
+        case Tag::redo:
+            read = transaction_depth == 0 && text_buffer.redo_count() > 0;
+            if (read) {
+                text_buffer.redo();
+            }
+            break;
+        case Tag::begin_transaction:
+            text_buffer.begin_transaction();
+            ++transaction_depth;
+            break;
+        case Tag::commit_transaction:
+            read = transaction_depth > 0;
+            if (read) {
+                text_buffer.commit_transaction();
+                --transaction_depth;
+            }
+            break;
+        case Tag::break_typing_burst:
+            text_buffer.break_typing_burst();
+            break;
+        default:
+            read = false;
+            break;
+        }
+        if (!read) {
+            break;
+        }
+        ++replay.records;
+        replay.valid_bytes = reader.position();
+    }
+
+    for (; transaction_depth > 0; --transaction_depth) {
+        text_buffer.commit_transaction();
+    }
+    return replay;
+}
+
+#endif  // EDIT_JOURNAL_H
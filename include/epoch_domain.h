@@ -0,0 +1,122 @@
+#ifndef EPOCH_DOMAIN_H
+#define EPOCH_DOMAIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Epoch-based reclamation, for objects read without locks while a writer
+// replaces them. A reader pins the current epoch for as long as it uses
+// an object. The writer unlinks the object, ends the epoch (advance()) and
+// frees the object once safe_epoch() reaches the value advance() returned:
+// by then every reader that could have seen it has unpinned.
+//
+// One domain serves any number of writers and readers, e.g. one per
+// process. Pinning is lock-free, but takes one of a fixed number of slots,
+// and waits for one to free up when more readers than that are pinned.
+class EpochDomain {
+  public:
+    using epoch_type = std::uint64_t;
+
+    // Unpins on destruction
+    class Guard {
+      public:
+        Guard() = default;
+
+        Guard(Guard&& other) noexcept
+            : slot_{std::exchange(other.slot_, nullptr)} {}
+
+        Guard& operator=(Guard&& other) noexcept {
+            if (this != &other) {
+                release();
+                slot_ = std::exchange(other.slot_, nullptr);
+            }
+            return *this;
+        }
+
+        ~Guard() { release(); }
+
+        void release() {
+            if (slot_ != nullptr) {
+                slot_->store(idle, std::memory_order_release);
+                slot_ = nullptr;
+            }
+        }
+
+      private:
+        friend class EpochDomain;
+
+        explicit Guard(std::atomic<epoch_type>* slot) : slot_{slot} {}
+
+        std::atomic<epoch_type>* slot_ = nullptr;
+    };
+
+    static std::size_t default_slot_count() {
+        return 4 * std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    explicit EpochDomain(std::size_t slot_count = default_slot_count())
+        : slots_{std::make_unique<Slot[]>(std::max<std::size_t>(slot_count,
+                                                                 1))}
+        , slot_count_{std::max<std::size_t>(slot_count, 1)} {}
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // Objects read after this are kept until the guard goes away
+    [[nodiscard]] Guard pin() {
+        // threads start at slots of their own, to keep off each other's
+        const std::size_t first = std::hash<std::thread::id>{}(
+            std::this_thread::get_id()) % slot_count_;
+        for (std::size_t i = first;; i = (i + 1) % slot_count_) {
+            std::atomic<epoch_type>& slot = slots_[i].epoch;
+            epoch_type expected = idle;
+            // seq_cst, the writer's scan must either see the pin or have
+            // unlinked the object before the reader loads it
+            if (slot.load(std::memory_order_relaxed) == idle
+                    && slot.compare_exchange_strong(expected, epoch_.load())) {
+                return Guard{&slot};
+            }
+            if ((i + 1) % slot_count_ == first) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Ends the current epoch. Objects unlinked before the call can be freed
+    // once safe_epoch() is at least the returned value.
+    epoch_type advance() {
+        return epoch_.fetch_add(1) + 1;
+    }
+
+    // The oldest epoch a reader may still be pinned in
+    [[nodiscard]] epoch_type safe_epoch() const {
+        epoch_type safe = epoch_.load();
+        for (std::size_t i = 0; i < slot_count_; ++i) {
+            const epoch_type pinned = slots_[i].epoch.load();
+            if (pinned != idle) {
+                safe = std::min(safe, pinned);
+            }
+        }
+        return safe;
+    }
+
+  private:
+    static constexpr epoch_type idle = 0;
+
+    // a cache line each, pinning writes only to its own
+    struct alignas(64) Slot {
+        std::atomic<epoch_type> epoch = idle;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t slot_count_;
+    std::atomic<epoch_type> epoch_ = 1;
+};
+
+#endif  // EPOCH_DOMAIN_H
@@ -0,0 +1,228 @@
+#ifndef LAZY_FILE_BUFFER_H
+#define LAZY_FILE_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File read region by region on first access, usable as PieceTable's
+// OriginalBufferT. Opening only stats the file, and with Load::background
+// the regions are also read in order on a thread of its own, so editing can
+// start while the file is still loading. Unlike with MappedFileBuffer,
+// a region once read stays in memory, so no later access blocks on I/O.
+//
+// A PieceTable opens it as one piece per region (see RegionedBuffer), so
+// every piece lies in a single region. Reading is thread-safe. Line-indexed
+// piece sequences scan the whole file on construction, which loads it all.
+// POSIX only.
+template <typename CharT = char>
+class LazyFileBuffer {
+    static_assert(std::is_trivially_copyable_v<CharT>);
+
+  public:
+    using value_type = CharT;
+    using size_type = std::size_t;
+
+    static constexpr size_type default_region_size = size_type{1} << 20;
+
+    enum class Load {
+        on_access,
+        background,  // regions not read yet are read in file order
+    };
+
+    LazyFileBuffer() = default;
+
+    // region_size is in elements
+    explicit LazyFileBuffer(const std::string& path,
+                            Load load = Load::on_access,
+                            size_type region_size = default_region_size)
+        : state_{std::make_unique<State>()} {
+        state_->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (state_->fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "open " + path);
+        }
+
+        struct stat file_stat;
+        if (::fstat(state_->fd, &file_stat) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "fstat " + path);
+        }
+
+        state_->size = static_cast<size_type>(file_stat.st_size)
+                       / sizeof(CharT);
+        state_->region_size = std::max<size_type>(region_size, 1);
+        state_->region_count = (state_->size + state_->region_size - 1)
+                               / state_->region_size;
+        state_->regions = std::make_unique<Region[]>(state_->region_count);
+
+        if (load == Load::background && state_->region_count > 0) {
+            loader_ = std::jthread{[state = state_.get()](
+                                       std::stop_token stop) {
+                for (size_type i = 0; i < state->region_count
+                                      && !stop.stop_requested(); ++i) {
+                    try {
+                        state->region_data(i);
+                    }
+                    catch (...) {
+                        // rethrown by the next access, the regions left
+                        // are read on access
+                        state->set_loader_error(std::current_exception());
+                        return;
+                    }
+                }
+            }};
+        }
+    }
+
+    LazyFileBuffer(LazyFileBuffer&&) noexcept = default;
+
+    LazyFileBuffer& operator=(LazyFileBuffer&& other) noexcept {
+        if (this != &other) {
+            // the loader reads into the state, stop it before freeing that
+            loader_ = std::jthread{};
+            state_ = std::move(other.state_);
+            loader_ = std::move(other.loader_);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] size_type size() const {
+        return state_ != nullptr ? state_->size : 0;
+    }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+
+    // Data is contiguous within a region only, see RegionedBuffer
+    [[nodiscard]] size_type region_size() const {
+        return state_ != nullptr ? state_->region_size : default_region_size;
+    }
+
+    [[nodiscard]] size_type region_count() const {
+        return state_ != nullptr ? state_->region_count : 0;
+    }
+
+    [[nodiscard]] bool is_loaded(size_type region) const {
+        return state_->regions[region].loaded.load(std::memory_order_acquire);
+    }
+
+    // Pointer to the element at offset, contiguous up to the end of its
+    // region. Reads the region if needed, throws std::system_error if that
+    // fails. The first access after the background loader failed rethrows
+    // its exception.
+    [[nodiscard]] const CharT* data_at(size_type offset) const {
+        if (offset >= size()) {
+            return nullptr;
+        }
+        state_->rethrow_loader_error();
+        const size_type region = offset / state_->region_size;
+        return state_->region_data(region)
+               + (offset - region * state_->region_size);
+    }
+
+  private:
+    struct Region {
+        std::mutex mutex;
+        std::atomic<bool> loaded = false;
+        std::unique_ptr<CharT[]> data;
+    };
+
+    // On the heap, so the loader thread's pointer survives moves
+    struct State {
+        State() = default;
+        State(const State&) = delete;
+        State& operator=(const State&) = delete;
+
+        ~State() {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        const CharT* region_data(size_type index) {
+            Region& region = regions[index];
+            if (!region.loaded.load(std::memory_order_acquire)) {
+                std::lock_guard lock{region.mutex};
+                if (!region.loaded.load(std::memory_order_relaxed)) {
+                    region.data = read_region(index);
+                    region.loaded.store(true, std::memory_order_release);
+                }
+            }
+            return region.data.get();
+        }
+
+        void set_loader_error(std::exception_ptr error) {
+            std::lock_guard lock{loader_error_mutex};
+            loader_error = std::move(error);
+            has_loader_error.store(true, std::memory_order_release);
+        }
+
+        void rethrow_loader_error() {
+            if (!has_loader_error.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::exception_ptr error;
+            {
+                std::lock_guard lock{loader_error_mutex};
+                error = std::exchange(loader_error, nullptr);
+                has_loader_error.store(false, std::memory_order_relaxed);
+            }
+            if (error != nullptr) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        std::unique_ptr<CharT[]> read_region(size_type index) const {
+            const size_type first = index * region_size;
+            const size_type count = std::min(region_size, size - first);
+            auto data = std::make_unique_for_overwrite<CharT[]>(count);
+            auto* out = reinterpret_cast<char*>(data.get());
+            size_type done = 0;
+            const size_type bytes = count * sizeof(CharT);
+            while (done < bytes) {
+                const ssize_t n = ::pread(
+                    fd, out + done, bytes - done,
+                    static_cast<off_t>(first * sizeof(CharT) + done));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    // a file truncated since opening reads short
+                    throw std::system_error(n < 0 ? errno : EIO,
+                                            std::generic_category(),
+                                            "pread");
+                }
+                done += static_cast<size_type>(n);
+            }
+            return data;
+        }
+
+        int fd = -1;
+        size_type size = 0;
+        size_type region_size = default_region_size;
+        size_type region_count = 0;
+        std::unique_ptr<Region[]> regions;
+        // set by the loader thread, taken by the next access
+        std::atomic<bool> has_loader_error = false;
+        std::mutex loader_error_mutex;
+        std::exception_ptr loader_error;
+    };
+
+    std::unique_ptr<State> state_;
+    // declared last, so it stops before the state goes away
+    std::jthread loader_;
+};
+
+#endif  // LAZY_FILE_BUFFER_H
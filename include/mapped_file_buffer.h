@@ -0,0 +1,147 @@
+#ifndef MAPPED_FILE_BUFFER_H
+#define MAPPED_FILE_BUFFER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only, memory-mapped file usable as PieceTable's OriginalBufferT.
+// Opening is O(1) - the kernel pages the content in on first access,
+// so huge files are editable right away. Move-only, unmaps on destruction.
+// POSIX only.
+template <typename CharT = char>
+class MappedFileBuffer {
+  public:
+    using value_type = CharT;
+    using size_type = std::size_t;
+    using const_iterator = const CharT*;
+    using iterator = const_iterator;
+
+    // Expected access pattern, passed on to madvise
+    enum class Access {
+        normal,
+        sequential,  // e.g. a file opened only to be saved or searched
+        random,      // e.g. jumping around a huge log
+    };
+
+    MappedFileBuffer() = default;
+
+    explicit MappedFileBuffer(const std::string& path,
+                              Access access = Access::normal) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "open " + path);
+        }
+
+        struct stat file_stat;
+        if (::fstat(fd, &file_stat) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(),
+                                    "fstat " + path);
+        }
+
+        const auto file_size = static_cast<size_type>(file_stat.st_size);
+        if (file_size == 0) {
+            // mmap refuses empty mappings, an empty buffer needs none anyway
+            ::close(fd);
+            return;
+        }
+
+        void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE,
+                               fd, 0);
+        const int error = errno;
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(),
+                                    "mmap " + path);
+        }
+
+        data_ = static_cast<const CharT*>(mapping);
+        size_ = file_size / sizeof(CharT);
+        mapped_bytes_ = file_size;
+        advise(access);
+    }
+
+    MappedFileBuffer(const MappedFileBuffer&) = delete;
+    MappedFileBuffer& operator=(const MappedFileBuffer&) = delete;
+
+    MappedFileBuffer(MappedFileBuffer&& other) noexcept
+        : data_{std::exchange(other.data_, nullptr)}
+        , size_{std::exchange(other.size_, 0)}
+        , mapped_bytes_{std::exchange(other.mapped_bytes_, 0)} {}
+
+    MappedFileBuffer& operator=(MappedFileBuffer&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            mapped_bytes_ = std::exchange(other.mapped_bytes_, 0);
+        }
+        return *this;
+    }
+
+    ~MappedFileBuffer() {
+        unmap();
+    }
+
+    // Hints have no effect on the content, failures are ignored
+    void advise(Access access) const {
+        if (data_ == nullptr) {
+            return;
+        }
+        int advice = MADV_NORMAL;
+        switch (access) {
+            case Access::normal: advice = MADV_NORMAL; break;
+            case Access::sequential: advice = MADV_SEQUENTIAL; break;
+            case Access::random: advice = MADV_RANDOM; break;
+        }
+        ::madvise(const_cast<CharT*>(data_), mapped_bytes_, advice);
+    }
+
+    // Asks the kernel to start reading [offset, offset + count) ahead
+    void prefetch(size_type offset, size_type count) const {
+        if (data_ == nullptr || offset >= size_) {
+            return;
+        }
+        // madvise needs a page-aligned start
+        const auto page = static_cast<size_type>(::sysconf(_SC_PAGESIZE));
+        const size_type first_byte = offset * sizeof(CharT) / page * page;
+        const size_type last_byte =
+            std::min(size_, offset + count) * sizeof(CharT);
+        ::madvise(const_cast<char*>(
+                      reinterpret_cast<const char*>(data_) + first_byte),
+                  last_byte - first_byte, MADV_WILLNEED);
+    }
+
+    [[nodiscard]] const CharT* data() const { return data_; }
+    [[nodiscard]] size_type size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    [[nodiscard]] const_iterator begin() const { return data_; }
+    [[nodiscard]] const_iterator end() const { return data_ + size_; }
+
+  private:
+    void unmap() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<CharT*>(data_), mapped_bytes_);
+            data_ = nullptr;
+        }
+    }
+
+    const CharT* data_ = nullptr;
+    size_type size_ = 0;
+    size_type mapped_bytes_ = 0;
+};
+
+#endif  // MAPPED_FILE_BUFFER_H
@@ -0,0 +1,287 @@
+#ifndef PERSISTENT_PIECE_TABLE_H
+#define PERSISTENT_PIECE_TABLE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "persistent_piece_tree.h"
+#include "piece_table.h"
+
+// Piece table keeping every version of the document. Each edit makes a new
+// PersistentPieceTree sharing all the untouched nodes with the previous one,
+// so a version costs O(log n) nodes and switching between versions (undo,
+// redo, or a jump to any other one) is O(1) - nothing is spliced back and
+// no sizes are recomputed.
+//
+// Versions form a tree: an edit after an undo starts a new branch instead
+// of dropping the redo history.
+//
+//     0 -- 1 -- 2 -- 3
+//                 |
+//                 +-- 4 -- 5   <- current, undo goes to 4, then 2, 1, 0
+//
+// The buffers only ever grow, the history is never trimmed.
+template <typename OriginalBufferT, typename AppendBufferT>
+class PersistentPieceTable {
+    static_assert(std::is_same_v<typename OriginalBufferT::value_type,
+                                 typename AppendBufferT::value_type>);
+
+  public:
+    using value_type = typename OriginalBufferT::value_type;
+    using size_type = std::size_t;
+    using version_id = size_type;
+
+    static constexpr version_id no_version
+        = std::numeric_limits<version_id>::max();
+
+    // A version of the document, readable while the table keeps being edited
+    // (from the thread editing it). O(1) to take. Valid until the table is
+    // destroyed or moved.
+    class Snapshot {
+      public:
+        Snapshot() = default;
+
+        [[nodiscard]] size_type size() const { return tree_.total_length(); }
+        [[nodiscard]] bool is_empty() const { return tree_.empty(); }
+
+        [[nodiscard]] value_type at(size_type idx) const {
+            assert(idx < size());
+            const auto [in_piece_offset, piece] = tree_.find_offset(idx);
+            value_type element;
+            table_->copy_piece_part(piece, in_piece_offset, 1, &element);
+            return element;
+        }
+
+        void copy_range(size_type idx, size_type count,
+                        std::span<value_type> out_span) const {
+            assert(idx + count <= size() && out_span.size() >= count);
+            value_type* out = out_span.data();
+            tree_.for_each_piece(idx, count, [&](const Piece& piece,
+                                                 size_type in_piece_offset,
+                                                 size_type part) {
+                table_->copy_piece_part(piece, in_piece_offset, part, out);
+                out += part;
+            });
+        }
+
+        [[nodiscard]] std::basic_string<value_type>
+        substr(size_type idx, size_type count) const {
+            std::basic_string<value_type> result(count, value_type{});
+            copy_range(idx, count, std::span{result});
+            return result;
+        }
+
+        [[nodiscard]] std::basic_string<value_type> to_string() const {
+            return substr(0, size());
+        }
+
+      private:
+        friend class PersistentPieceTable;
+
+        Snapshot(const PersistentPieceTable* table, PersistentPieceTree tree)
+            : table_{table}, tree_{std::move(tree)} {}
+
+        const PersistentPieceTable* table_ = nullptr;
+        PersistentPieceTree tree_;
+    };
+
+    PersistentPieceTable() : versions_{Version{}} {}
+
+    PersistentPieceTable(OriginalBufferT original_buffer)
+        : PersistentPieceTable{std::move(original_buffer), AppendBufferT{}} {}
+
+    // Takes an empty append buffer as well, to configure it (e.g. the memory
+    // resource of a ChunkedAppendBuffer)
+    PersistentPieceTable(OriginalBufferT original_buffer,
+                         AppendBufferT append_buffer)
+        : original_buffer_{std::move(original_buffer)}
+        , append_buffer_{std::move(append_buffer)}
+        , versions_{Version{PersistentPieceTree{
+              Piece{0, std::size(original_buffer_), false}}}} {
+        assert(std::empty(append_buffer_));
+    }
+
+    // Snapshots point to the table they were taken from
+    PersistentPieceTable(const PersistentPieceTable&) = delete;
+    PersistentPieceTable& operator=(const PersistentPieceTable&) = delete;
+    PersistentPieceTable(PersistentPieceTable&&) = default;
+    PersistentPieceTable& operator=(PersistentPieceTable&&) = default;
+
+    [[nodiscard]] bool is_empty() const {
+        return tree().empty();
+    }
+
+    [[nodiscard]] size_type length() const {
+        return size();
+    }
+    [[nodiscard]] size_type size() const {
+        return tree().total_length();
+    }
+
+    [[nodiscard]] value_type at(size_type idx) const {
+        return snapshot().at(idx);
+    }
+
+    void copy_range(size_type idx, size_type count,
+                    std::span<value_type> out_span) const {
+        snapshot().copy_range(idx, count, out_span);
+    }
+
+    [[nodiscard]] std::basic_string<value_type>
+    substr(size_type idx, size_type count) const {
+        return snapshot().substr(idx, count);
+    }
+
+    [[nodiscard]] std::basic_string<value_type> to_string() const {
+        return snapshot().to_string();
+    }
+
+    [[nodiscard]] Snapshot snapshot() const {
+        return Snapshot{this, tree()};
+    }
+
+    [[nodiscard]] Snapshot snapshot(version_id version) const {
+        assert(version < versions_.size());
+        return Snapshot{this, versions_[version].tree};
+    }
+
+    void clear() {
+        commit(PersistentPieceTree{});
+    }
+
+    void insert_at(size_type idx, value_type element) {
+        insert_range_at(idx, std::basic_string_view<value_type>{&element, 1});
+    }
+
+    template <typename InputRange>
+    void insert_range_at(size_type idx, const InputRange& range) {
+        assert(idx <= size());
+        const auto count = static_cast<size_type>(std::size(range));
+        if (count == 0) {
+            return;
+        }
+        const size_type start = appendToBuffer(append_buffer_, range);
+        commit(tree().insert(idx, Piece{start, count, true}));
+    }
+
+    void append(value_type element) {
+        insert_at(size(), element);
+    }
+
+    template <typename InputRange>
+    void append_range(const InputRange& range) {
+        insert_range_at(size(), range);
+    }
+
+    void delete_at(size_type idx) {
+        delete_range_at(idx, 1);
+    }
+
+    void delete_range_at(size_type idx, size_type count) {
+        assert(idx + count <= size());
+        if (count == 0) {
+            return;
+        }
+        commit(tree().erase(idx, count));
+    }
+
+    // The version the document is at, 0 being the original one
+    [[nodiscard]] version_id current_version() const { return current_; }
+    [[nodiscard]] size_type version_count() const { return versions_.size(); }
+
+    // The version the given one was edited from, or no_version
+    [[nodiscard]] version_id parent_version(version_id version) const {
+        assert(version < versions_.size());
+        return versions_[version].parent;
+    }
+
+    [[nodiscard]] bool can_undo() const {
+        return versions_[current_].parent != no_version;
+    }
+    [[nodiscard]] bool can_redo() const {
+        return versions_[current_].last_child != no_version;
+    }
+
+    void undo() {
+        assert(can_undo());
+        current_ = versions_[current_].parent;
+    }
+
+    // Follows the most recently visited branch
+    void redo() {
+        assert(can_redo());
+        current_ = versions_[current_].last_child;
+    }
+
+    // Switches to any version, e.g. one on another branch. Undo and redo
+    // then walk from there.
+    void checkout(version_id version) {
+        assert(version < versions_.size());
+        for (version_id child = version; versions_[child].parent != no_version;
+                child = versions_[child].parent) {
+            versions_[versions_[child].parent].last_child = child;
+        }
+        current_ = version;
+    }
+
+  private:
+    struct Version {
+        PersistentPieceTree tree;
+        version_id parent = no_version;
+        version_id last_child = no_version;
+    };
+
+    const PersistentPieceTree& tree() const {
+        return versions_[current_].tree;
+    }
+
+    void commit(PersistentPieceTree tree) {
+        const auto version = static_cast<version_id>(versions_.size());
+        versions_.push_back({std::move(tree), current_, no_version});
+        versions_[current_].last_child = version;
+        current_ = version;
+    }
+
+    // Copies count elements of the piece, starting at in_piece_offset
+    void copy_piece_part(const Piece& piece, size_type in_piece_offset,
+                         size_type count, value_type* out) const {
+        if (piece.appended_sequence) {
+            copy_buffer_part(append_buffer_, piece.start + in_piece_offset,
+                             count, out);
+        }
+        else {
+            copy_buffer_part(original_buffer_, piece.start + in_piece_offset,
+                             count, out);
+        }
+    }
+
+    template <typename BufferT>
+    static void copy_buffer_part(const BufferT& buffer, size_type start,
+                                 size_type count, value_type* out) {
+        const auto first = bufferIteratorAt(buffer, start);
+        if constexpr (std::contiguous_iterator<decltype(first)>
+                      && std::is_trivially_copyable_v<value_type>) {
+            std::memcpy(out, std::to_address(first),
+                        count * sizeof(value_type));
+        }
+        else {
+            std::copy_n(first, count, out);
+        }
+    }
+
+    OriginalBufferT original_buffer_;
+    AppendBufferT append_buffer_;
+    std::vector<Version> versions_;
+    version_id current_ = 0;
+};
+
+#endif  // PERSISTENT_PIECE_TABLE_H
@@ -0,0 +1,248 @@
+#ifndef PERSISTENT_PIECE_TREE_H
+#define PERSISTENT_PIECE_TREE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "piece.h"
+
+// Immutable piece sequence: a treap whose edits copy only the nodes on
+// the paths to the changed pieces (O(log n) new nodes) and share all the
+// others with the tree they were made from. A tree is a cheap value -
+// copying it is a reference count increment - and old trees stay valid and
+// unchanged, so keeping an old version around is all undo needs.
+//
+// Nodes are reference counted with std::shared_ptr and never modified once
+// built, so trees can be read from any number of threads at once.
+class PersistentPieceTree {
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        Piece value;
+        NodePtr left;
+        NodePtr right;
+        std::size_t subtree_length;
+        std::size_t subtree_count;
+        std::uint64_t priority;
+    };
+
+  public:
+    using size_type = std::size_t;
+
+    PersistentPieceTree() = default;
+
+    explicit PersistentPieceTree(const Piece& piece) {
+        if (piece.size > 0) {
+            root_ = make_node(piece, nullptr, nullptr, make_priority(piece));
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return root_ == nullptr; }
+    [[nodiscard]] size_type size() const { return count_of(root_); }
+
+    // Sum of the sizes of all the pieces
+    [[nodiscard]] size_type total_length() const { return length_of(root_); }
+
+    // The piece containing offset (< total_length()), and offset in it
+    [[nodiscard]] PieceTablePosition<Piece> find_offset(size_type offset) const {
+        assert(offset < total_length());
+        const Node* node = root_.get();
+        while (true) {
+            if (offset < length_of(node->left)) {
+                node = node->left.get();
+                continue;
+            }
+            offset -= length_of(node->left);
+            if (offset < node->value.size) {
+                return {offset, node->value};
+            }
+            offset -= node->value.size;
+            node = node->right.get();
+        }
+    }
+
+    // The tree with piece inserted at offset. If the piece continues, in
+    // the append buffer, the piece ending at offset (e.g. typing), that one
+    // grows instead, like in PieceTable.
+    [[nodiscard]] PersistentPieceTree insert(size_type offset,
+                                             const Piece& piece) const {
+        assert(offset <= total_length());
+        if (piece.size == 0) {
+            return *this;
+        }
+        auto [left, right] = split(root_, offset);
+        const Node* last = rightmost(left.get());
+        if (last != nullptr && piece.appended_sequence
+                && last->value.appended_sequence
+                && last->value.start + last->value.size == piece.start) {
+            left = grow_rightmost(left, piece.size);
+        }
+        else {
+            left = merge(left, make_node(piece, nullptr, nullptr,
+                                         make_priority(piece)));
+        }
+        return PersistentPieceTree{merge(left, right)};
+    }
+
+    // The tree without [offset, offset + count)
+    [[nodiscard]] PersistentPieceTree erase(size_type offset,
+                                            size_type count) const {
+        assert(offset + count <= total_length());
+        if (count == 0) {
+            return *this;
+        }
+        auto [left, rest] = split(root_, offset);
+        auto [erased, right] = split(rest, count);
+        return PersistentPieceTree{merge(left, right)};
+    }
+
+    // Calls f(piece, in_piece_offset, count) for the parts of the pieces
+    // covering [offset, offset + count), in order. O(log n + parts).
+    template <typename F>
+    void for_each_piece(size_type offset, size_type count, F&& f) const {
+        assert(offset + count <= total_length());
+        visit(root_.get(), offset, count, f);
+    }
+
+    template <typename F>
+    void for_each_piece(F&& f) const {
+        visit(root_.get(), 0, total_length(), f);
+    }
+
+  private:
+    explicit PersistentPieceTree(NodePtr root) : root_{std::move(root)} {}
+
+    static size_type length_of(const NodePtr& node) {
+        return node != nullptr ? node->subtree_length : 0;
+    }
+
+    static size_type count_of(const NodePtr& node) {
+        return node != nullptr ? node->subtree_count : 0;
+    }
+
+    static NodePtr make_node(const Piece& value, NodePtr left, NodePtr right,
+                             std::uint64_t priority) {
+        const size_type length = length_of(left) + value.size
+                                 + length_of(right);
+        const size_type count = count_of(left) + 1 + count_of(right);
+        return std::make_shared<const Node>(Node{
+            value, std::move(left), std::move(right), length, count,
+            priority});
+    }
+
+    // node with other children, node itself if they are the same
+    static NodePtr with_children(const NodePtr& node, NodePtr left,
+                                 NodePtr right) {
+        if (left == node->left && right == node->right) {
+            return node;
+        }
+        return make_node(node->value, std::move(left), std::move(right),
+                         node->priority);
+    }
+
+    // Splits into the first offset elements and the rest, cutting the piece
+    // containing offset in two if needed
+    static std::pair<NodePtr, NodePtr> split(const NodePtr& node,
+                                             size_type offset) {
+        if (node == nullptr) {
+            return {nullptr, nullptr};
+        }
+        const size_type left_length = length_of(node->left);
+        if (offset <= left_length) {
+            auto [left, right] = split(node->left, offset);
+            return {std::move(left),
+                    with_children(node, std::move(right), node->right)};
+        }
+        offset -= left_length;
+        if (offset >= node->value.size) {
+            auto [left, right] = split(node->right, offset - node->value.size);
+            return {with_children(node, node->left, std::move(left)),
+                    std::move(right)};
+        }
+
+        const Piece& piece = node->value;
+        const Piece left_part{piece.start, offset, piece.appended_sequence};
+        const Piece right_part{piece.start + offset, piece.size - offset,
+                               piece.appended_sequence};
+        // the right part needs a priority of its own - all the parts of
+        // a piece sharing one would degenerate the treap into a list
+        return {make_node(left_part, node->left, nullptr, node->priority),
+                merge(make_node(right_part, nullptr, nullptr,
+                                make_priority(right_part)),
+                      node->right)};
+    }
+
+    static NodePtr merge(const NodePtr& left, const NodePtr& right) {
+        if (left == nullptr) {
+            return right;
+        }
+        if (right == nullptr) {
+            return left;
+        }
+        if (left->priority > right->priority) {
+            return with_children(left, left->left, merge(left->right, right));
+        }
+        return with_children(right, merge(left, right->left), right->right);
+    }
+
+    static const Node* rightmost(const Node* node) {
+        while (node != nullptr && node->right != nullptr) {
+            node = node->right.get();
+        }
+        return node;
+    }
+
+    static NodePtr grow_rightmost(const NodePtr& node, size_type size) {
+        if (node->right != nullptr) {
+            return with_children(node, node->left,
+                                 grow_rightmost(node->right, size));
+        }
+        Piece grown = node->value;
+        grown.size += size;
+        return make_node(grown, node->left, nullptr, node->priority);
+    }
+
+    template <typename F>
+    static void visit(const Node* node, size_type offset, size_type count,
+                      F& f) {
+        if (node == nullptr || count == 0) {
+            return;
+        }
+        const size_type piece_first = length_of(node->left);
+        const size_type piece_last = piece_first + node->value.size;
+        if (offset < piece_first) {
+            visit(node->left.get(), offset,
+                  std::min(count, piece_first - offset), f);
+        }
+        const size_type first = std::max(offset, piece_first);
+        const size_type last = std::min(offset + count, piece_last);
+        if (first < last) {
+            f(node->value, first - piece_first, last - first);
+        }
+        if (offset + count > piece_last) {
+            const size_type right_first = std::max(offset, piece_last);
+            visit(node->right.get(), right_first - piece_last,
+                  offset + count - right_first, f);
+        }
+    }
+
+    static std::uint64_t make_priority(const Piece& piece) {
+        // splitmix64 of the piece start - pieces of a tree don't share
+        // starts, and the value must survive copying the node
+        auto x = static_cast<std::uint64_t>(piece.start) * 2
+                 + piece.appended_sequence;
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    NodePtr root_;
+};
+
+#endif  // PERSISTENT_PIECE_TREE_H
@@ -0,0 +1,53 @@
+#ifndef PIECE_H
+#define PIECE_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+struct Piece {
+    // bounds of start + size (the buffer offsets) and of size
+    static constexpr std::size_t max_end
+        = std::numeric_limits<std::size_t>::max();
+    static constexpr std::size_t max_size
+        = std::numeric_limits<std::size_t>::max();
+
+    std::size_t start;
+    std::size_t size;
+    bool appended_sequence;
+};
+
+// Piece packed into 8 bytes instead of 24, for buffers under 4 Gi elements
+// - a piece sequence of them (e.g. std::list<CompactPiece>) switches
+// PieceTable to it. Pieces longer than max_size are split by PieceTable.
+struct CompactPiece {
+    static constexpr std::size_t max_end = std::size_t{1} << 32;
+    static constexpr std::size_t max_size = (std::size_t{1} << 31) - 1;
+
+    std::uint32_t start;
+    std::uint32_t size : 31;
+    std::uint32_t appended_sequence : 1;
+};
+
+static_assert(sizeof(CompactPiece) == 8);
+
+// Brace initialization would narrow into the compact fields
+template <typename PieceT>
+constexpr PieceT makePiece(std::size_t start, std::size_t size,
+                           bool appended_sequence) {
+    assert(size <= PieceT::max_size && start <= PieceT::max_end - size);
+    PieceT piece{};
+    piece.start = start;
+    piece.size = size;
+    piece.appended_sequence = appended_sequence;
+    return piece;
+}
+
+template <typename Iter>
+struct PieceTablePosition {
+    std::size_t in_piece_offset;
+    Iter it;
+};
+
+#endif  // PIECE_H
@@ -0,0 +1,618 @@
+#ifndef PIECE_BTREE_H
+#define PIECE_BTREE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "piece.h"
+
+// Piece sequence kept as a B+ tree. Leaves store pieces in contiguous arrays,
+// packed to 16 bytes each (the appended flag lives in the top bit of start),
+// and are linked for sequential iteration. Inner nodes keep prefix sums of
+// their children lengths and piece counts, so looking up an offset or an
+// index reads a few cache lines per level instead of chasing a node per piece.
+//
+// Pieces move between leaves on every modification, so there are no stable
+// handles - PieceTable addresses pieces by their index in the sequence
+// (see IndexReplaceable), same as for random access containers.
+class PieceBTree {
+  public:
+    static constexpr std::size_t leaf_capacity = 64;
+    static constexpr std::size_t inner_capacity = 64;
+
+  private:
+    struct PackedPiece {
+        static constexpr std::size_t appended_bit =
+            std::size_t{1} << (std::numeric_limits<std::size_t>::digits - 1);
+
+        std::size_t start_and_flag;
+        std::size_t size;
+
+        static PackedPiece pack(const Piece& piece) {
+            assert((piece.start & appended_bit) == 0);
+            return {
+                piece.start | (piece.appended_sequence ? appended_bit : 0),
+                piece.size
+            };
+        }
+
+        Piece unpack() const {
+            return {
+                .start = start_and_flag & ~appended_bit,
+                .size = size,
+                .appended_sequence = (start_and_flag & appended_bit) != 0
+            };
+        }
+    };
+
+    static_assert(sizeof(PackedPiece) == 2 * sizeof(std::size_t));
+
+    struct Inner;
+
+    struct Node {
+        Inner* parent = nullptr;
+        std::size_t count = 0;   // children or pieces held by this node
+        std::size_t length = 0;  // sum of piece sizes in the subtree
+        std::size_t pieces = 0;  // number of pieces in the subtree
+        bool is_leaf;
+
+        explicit Node(bool leaf) : is_leaf{leaf} {}
+    };
+
+    struct Leaf : Node {
+        Leaf* prev = nullptr;
+        Leaf* next = nullptr;
+        PackedPiece entries[leaf_capacity];
+
+        Leaf() : Node{true} {}
+    };
+
+    struct Inner : Node {
+        Node* children[inner_capacity];
+        std::size_t length_prefix[inner_capacity];
+        std::size_t count_prefix[inner_capacity];
+
+        Inner() : Node{false} {}
+    };
+
+    // Pieces are stored packed, so dereferencing yields a Piece by value
+    struct ArrowProxy {
+        Piece piece;
+        const Piece* operator->() const { return &piece; }
+    };
+
+  public:
+    class const_iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Piece;
+        using difference_type = std::ptrdiff_t;
+        using pointer = ArrowProxy;
+        using reference = Piece;
+
+        const_iterator() = default;
+
+        Piece operator*() const { return leaf_->entries[slot_].unpack(); }
+        ArrowProxy operator->() const { return {**this}; }
+
+        const_iterator& operator++() {
+            ++index_;
+            if (++slot_ == leaf_->count && leaf_->next != nullptr) {
+                leaf_ = leaf_->next;
+                slot_ = 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        const_iterator& operator--() {
+            --index_;
+            if (slot_ == 0) {
+                leaf_ = leaf_->prev;
+                slot_ = leaf_->count;
+            }
+            --slot_;
+            return *this;
+        }
+        const_iterator operator--(int) {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        friend bool operator==(const const_iterator& lhs,
+                               const const_iterator& rhs) {
+            return lhs.index_ == rhs.index_;
+        }
+
+        // Position of the piece in the sequence
+        [[nodiscard]] std::size_t index() const { return index_; }
+
+      private:
+        friend class PieceBTree;
+        const_iterator(Leaf* leaf, std::size_t slot, std::size_t index)
+            : leaf_{leaf}, slot_{slot}, index_{index} {}
+
+        Leaf* leaf_ = nullptr;
+        std::size_t slot_ = 0;
+        std::size_t index_ = 0;
+    };
+
+    using value_type = Piece;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = Piece;
+    using const_reference = Piece;
+    using iterator = const_iterator;
+
+    // A whole leaf is too heavy to hold the few pieces cut out by an edit
+    using undo_sequence_type = std::vector<Piece>;
+
+    PieceBTree() = default;
+
+    PieceBTree(std::initializer_list<Piece> pieces) {
+        insert(0, pieces.begin(), pieces.end());
+    }
+
+    PieceBTree(const PieceBTree& other) {
+        insert(0, other.begin(), other.end());
+    }
+
+    PieceBTree(PieceBTree&& other) noexcept
+        : root_{std::exchange(other.root_, nullptr)}
+        , first_leaf_{std::exchange(other.first_leaf_, nullptr)}
+        , last_leaf_{std::exchange(other.last_leaf_, nullptr)} {}
+
+    PieceBTree& operator=(const PieceBTree& other) {
+        if (this != &other) {
+            PieceBTree copy{other};
+            swap(copy);
+        }
+        return *this;
+    }
+
+    PieceBTree& operator=(PieceBTree&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~PieceBTree() {
+        clear();
+    }
+
+    void swap(PieceBTree& other) noexcept {
+        std::swap(root_, other.root_);
+        std::swap(first_leaf_, other.first_leaf_);
+        std::swap(last_leaf_, other.last_leaf_);
+    }
+
+    [[nodiscard]] const_iterator begin() const {
+        return {first_leaf_, 0, 0};
+    }
+    [[nodiscard]] const_iterator end() const {
+        if (root_ == nullptr) {
+            return {};
+        }
+        return {last_leaf_, last_leaf_->count, size()};
+    }
+    [[nodiscard]] const_iterator cbegin() const { return begin(); }
+    [[nodiscard]] const_iterator cend() const { return end(); }
+
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    [[nodiscard]] size_type size() const {
+        return root_ != nullptr ? root_->pieces : 0;
+    }
+
+    // Sum of the sizes of all the pieces
+    [[nodiscard]] size_type total_length() const {
+        return root_ != nullptr ? root_->length : 0;
+    }
+
+    // Returns the first piece with size > offset, after subtracting the sizes
+    // of all the pieces before it - same result as the linear scan.
+    [[nodiscard]] PieceTablePosition<const_iterator>
+    find_offset(size_type offset) const {
+        if (offset >= total_length()) {
+            return {offset - total_length(), end()};
+        }
+
+        const Node* node = root_;
+        size_type index = 0;
+        while (!node->is_leaf) {
+            const auto* inner = static_cast<const Inner*>(node);
+            const auto child = static_cast<size_type>(
+                std::upper_bound(inner->length_prefix,
+                                 inner->length_prefix + inner->count, offset)
+                - inner->length_prefix);
+            if (child > 0) {
+                offset -= inner->length_prefix[child - 1];
+                index += inner->count_prefix[child - 1];
+            }
+            node = inner->children[child];
+        }
+
+        auto* leaf = static_cast<Leaf*>(const_cast<Node*>(node));
+        size_type slot = 0;
+        while (leaf->entries[slot].size <= offset) {
+            offset -= leaf->entries[slot].size;
+            ++slot;
+        }
+        return {offset, const_iterator{leaf, slot, index + slot}};
+    }
+
+    [[nodiscard]] const_iterator nth(size_type index) const {
+        if (root_ == nullptr) {
+            return {};
+        }
+        auto [leaf, slot] = locate_index(index);
+        return {leaf, slot, index};
+    }
+
+    [[nodiscard]] size_type index_of(const_iterator pos) const {
+        return pos.index();
+    }
+
+    template <typename InputIt>
+    void insert(size_type index, InputIt first, InputIt last) {
+        assert(index <= size());
+        if (first == last) {
+            return;
+        }
+        if (root_ == nullptr) {
+            root_ = first_leaf_ = last_leaf_ = new Leaf;
+        }
+
+        auto [leaf, slot] = locate_index(index);
+        for (; first != last; ++first) {
+            if (leaf->count == leaf_capacity) {
+                // appending at the end of a leaf (typical for bulk inserts)
+                // starts a fresh leaf instead of leaving two half-empty ones
+                const size_type split_at = slot == leaf_capacity
+                                           ? leaf_capacity
+                                           : leaf_capacity / 2;
+                Leaf* right = split_leaf(leaf, split_at);
+                if (slot >= split_at) {
+                    slot -= split_at;
+                    leaf = right;
+                }
+            }
+            std::move_backward(leaf->entries + slot,
+                               leaf->entries + leaf->count,
+                               leaf->entries + leaf->count + 1);
+            leaf->entries[slot] = PackedPiece::pack(*first);
+            ++leaf->count;
+            ++slot;
+        }
+        refresh_upwards(leaf);
+    }
+
+    void erase(size_type first, size_type last) {
+        assert(first <= last && last <= size());
+        size_type remaining = last - first;
+        while (remaining > 0) {
+            auto [leaf, slot] = locate_index(first);
+            const size_type erased = std::min(remaining, leaf->count - slot);
+            std::move(leaf->entries + slot + erased,
+                      leaf->entries + leaf->count,
+                      leaf->entries + slot);
+            leaf->count -= erased;
+            remaining -= erased;
+            rebalance(leaf);
+        }
+    }
+
+    // Replaces pieces [first, last) with [new_first, new_last)
+    template <typename InputIt>
+    void replace(size_type first, size_type last,
+                 InputIt new_first, InputIt new_last) {
+        erase(first, last);
+        insert(first, new_first, new_last);
+    }
+
+    void clear() {
+        destroy(root_);
+        root_ = nullptr;
+        first_leaf_ = last_leaf_ = nullptr;
+    }
+
+  private:
+    // Finds the leaf and slot of the piece at index. For index == size()
+    // returns the past-the-end slot of the last leaf.
+    std::pair<Leaf*, size_type> locate_index(size_type index) const {
+        Node* node = root_;
+        while (!node->is_leaf) {
+            auto* inner = static_cast<Inner*>(node);
+            const auto child = std::min(
+                static_cast<size_type>(
+                    std::upper_bound(inner->count_prefix,
+                                     inner->count_prefix + inner->count, index)
+                    - inner->count_prefix),
+                inner->count - 1);
+            if (child > 0) {
+                index -= inner->count_prefix[child - 1];
+            }
+            node = inner->children[child];
+        }
+        return {static_cast<Leaf*>(node), index};
+    }
+
+    static void recompute(Node* node) {
+        if (node->is_leaf) {
+            auto* leaf = static_cast<Leaf*>(node);
+            size_type length = 0;
+            for (size_type i = 0; i < leaf->count; ++i) {
+                length += leaf->entries[i].size;
+            }
+            leaf->length = length;
+            leaf->pieces = leaf->count;
+        }
+        else {
+            auto* inner = static_cast<Inner*>(node);
+            size_type length = 0;
+            size_type pieces = 0;
+            for (size_type i = 0; i < inner->count; ++i) {
+                Node* child = inner->children[i];
+                child->parent = inner;
+                length += child->length;
+                pieces += child->pieces;
+                inner->length_prefix[i] = length;
+                inner->count_prefix[i] = pieces;
+            }
+            inner->length = length;
+            inner->pieces = pieces;
+        }
+    }
+
+    static void refresh_upwards(Node* node) {
+        for (; node != nullptr; node = node->parent) {
+            recompute(node);
+        }
+    }
+
+    static size_type child_index(const Inner* parent, const Node* child) {
+        return static_cast<size_type>(
+            std::find(parent->children, parent->children + parent->count, child)
+            - parent->children);
+    }
+
+    static size_type capacity_of(const Node* node) {
+        return node->is_leaf ? leaf_capacity : inner_capacity;
+    }
+
+    // Moves entries [at, count) of the leaf into a new leaf placed after it
+    Leaf* split_leaf(Leaf* leaf, size_type at) {
+        Leaf* right = new Leaf;
+        std::copy(leaf->entries + at, leaf->entries + leaf->count,
+                  right->entries);
+        right->count = leaf->count - at;
+        leaf->count = at;
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next != nullptr) {
+            leaf->next->prev = right;
+        }
+        else {
+            last_leaf_ = right;
+        }
+        leaf->next = right;
+
+        recompute(leaf);
+        recompute(right);
+        insert_after(leaf, right);
+        return right;
+    }
+
+    // Links new_node into the tree as the next sibling of node,
+    // splitting full inner nodes on the way up
+    void insert_after(Node* node, Node* new_node) {
+        Inner* parent = node->parent;
+        if (parent == nullptr) {
+            auto* root = new Inner;
+            root->children[0] = node;
+            root->children[1] = new_node;
+            root->count = 2;
+            recompute(root);
+            root_ = root;
+            return;
+        }
+
+        size_type position = child_index(parent, node) + 1;
+        if (parent->count == inner_capacity) {
+            auto* right = new Inner;
+            const size_type half = inner_capacity / 2;
+            std::copy(parent->children + half,
+                      parent->children + parent->count, right->children);
+            right->count = parent->count - half;
+            parent->count = half;
+            recompute(parent);
+            recompute(right);
+            insert_after(parent, right);
+            if (position > half) {
+                position -= half;
+                parent = right;
+            }
+        }
+
+        std::copy_backward(parent->children + position,
+                           parent->children + parent->count,
+                           parent->children + parent->count + 1);
+        parent->children[position] = new_node;
+        ++parent->count;
+        refresh_upwards(parent);
+    }
+
+    void remove_child(Inner* parent, size_type position) {
+        std::copy(parent->children + position + 1,
+                  parent->children + parent->count,
+                  parent->children + position);
+        --parent->count;
+    }
+
+    void unlink_leaf(Leaf* leaf) {
+        (leaf->prev != nullptr ? leaf->prev->next : first_leaf_) = leaf->next;
+        (leaf->next != nullptr ? leaf->next->prev : last_leaf_) = leaf->prev;
+    }
+
+    void destroy_node(Node* node) {
+        if (node->is_leaf) {
+            unlink_leaf(static_cast<Leaf*>(node));
+            delete static_cast<Leaf*>(node);
+        }
+        else {
+            delete static_cast<Inner*>(node);
+        }
+    }
+
+    // Moves all entries of right to the end of left
+    static void merge_into(Node* left, Node* right) {
+        if (left->is_leaf) {
+            auto* l = static_cast<Leaf*>(left);
+            auto* r = static_cast<Leaf*>(right);
+            std::copy(r->entries, r->entries + r->count, l->entries + l->count);
+        }
+        else {
+            auto* l = static_cast<Inner*>(left);
+            auto* r = static_cast<Inner*>(right);
+            std::copy(r->children, r->children + r->count,
+                      l->children + l->count);
+        }
+        left->count += right->count;
+        right->count = 0;
+    }
+
+    // Evens out entry counts of two neighbouring nodes
+    static void redistribute(Node* left, Node* right) {
+        const size_type total = left->count + right->count;
+        const size_type new_left = total / 2;
+        if (left->is_leaf) {
+            auto* l = static_cast<Leaf*>(left);
+            auto* r = static_cast<Leaf*>(right);
+            if (l->count < new_left) {
+                const size_type moved = new_left - l->count;
+                std::copy(r->entries, r->entries + moved,
+                          l->entries + l->count);
+                std::move(r->entries + moved, r->entries + r->count,
+                          r->entries);
+            }
+            else {
+                const size_type moved = l->count - new_left;
+                std::move_backward(r->entries, r->entries + r->count,
+                                   r->entries + r->count + moved);
+                std::copy(l->entries + new_left, l->entries + l->count,
+                          r->entries);
+            }
+        }
+        else {
+            auto* l = static_cast<Inner*>(left);
+            auto* r = static_cast<Inner*>(right);
+            if (l->count < new_left) {
+                const size_type moved = new_left - l->count;
+                std::copy(r->children, r->children + moved,
+                          l->children + l->count);
+                std::copy(r->children + moved, r->children + r->count,
+                          r->children);
+            }
+            else {
+                const size_type moved = l->count - new_left;
+                std::copy_backward(r->children, r->children + r->count,
+                                   r->children + r->count + moved);
+                std::copy(l->children + new_left, l->children + l->count,
+                          r->children);
+            }
+        }
+        left->count = new_left;
+        right->count = total - new_left;
+    }
+
+    // Restores the fill invariants after entries were removed from node,
+    // merging or evening out underfull nodes with a sibling, and refreshes
+    // the prefix sums up to the root
+    void rebalance(Node* node) {
+        while (node->parent != nullptr) {
+            Inner* parent = node->parent;
+            if (node->count >= capacity_of(node) / 4) {
+                refresh_upwards(node);
+                return;
+            }
+
+            const size_type position = child_index(parent, node);
+            if (parent->count == 1) {
+                if (node->count == 0) {
+                    remove_child(parent, position);
+                    destroy_node(node);
+                }
+                else {
+                    recompute(node);
+                }
+                node = parent;
+                continue;
+            }
+
+            const size_type left_position = position > 0 ? position - 1
+                                                         : position;
+            Node* left = parent->children[left_position];
+            Node* right = parent->children[left_position + 1];
+            if (left->count + right->count <= capacity_of(node)) {
+                merge_into(left, right);
+                remove_child(parent, left_position + 1);
+                destroy_node(right);
+                recompute(left);
+            }
+            else {
+                redistribute(left, right);
+                recompute(left);
+                recompute(right);
+            }
+            node = parent;
+        }
+
+        // node is the root now, drop levels that lost all their siblings
+        while (!node->is_leaf && node->count == 1) {
+            Node* child = static_cast<Inner*>(node)->children[0];
+            delete static_cast<Inner*>(node);
+            child->parent = nullptr;
+            node = root_ = child;
+        }
+        if (node->count == 0) {
+            destroy_node(node);
+            root_ = nullptr;
+            return;
+        }
+        recompute(node);
+    }
+
+    void destroy(Node* node) {
+        if (node == nullptr) {
+            return;
+        }
+        if (node->is_leaf) {
+            delete static_cast<Leaf*>(node);
+        }
+        else {
+            auto* inner = static_cast<Inner*>(node);
+            for (size_type i = 0; i < inner->count; ++i) {
+                destroy(inner->children[i]);
+            }
+            delete inner;
+        }
+    }
+
+    Node* root_ = nullptr;
+    Leaf* first_leaf_ = nullptr;
+    Leaf* last_leaf_ = nullptr;
+};
+
+#endif  // PIECE_BTREE_H
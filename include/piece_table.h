@@ -1,31 +1,141 @@
 #ifndef PIECE_TABLE_H
 #define PIECE_TABLE_H
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cerrno>
+#include <concepts>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <ranges>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
-struct Piece {
-    std::size_t start;
-    std::size_t size;
-    bool appended_sequence;
-};
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
-template <typename Iter>
-struct PieceTablePosition {
-    std::size_t in_piece_offset;
-    Iter it;
-};
+#include "piece.h"
+#include "piece_table_stats.h"
+#include "simd_scan.h"
 
 template <typename Container>
 concept Splicable = requires(Container c) {
     { c.splice(c.end(), c, c.begin(), c.end()) };
 };
 
+// Indexed sequences without stable handles that replace a range of pieces
+// (by their positions) in one go, faster than erase + insert (e.g. PieceBTree)
+template <typename Container>
+concept IndexReplaceable = requires(Container c, const Piece* p) {
+    { c.replace(std::size_t{}, std::size_t{}, p, p) };
+};
+
+// Buffers split into separately allocated blocks (e.g. ChunkedAppendBuffer)
+// choose themselves where appended data lands, so that it never straddles
+// two blocks, and return its start offset
+template <typename BufferT>
+concept PieceAppendable = requires(BufferT b,
+                                   const typename BufferT::value_type* p) {
+    { b.append_piece(p, p) } -> std::convertible_to<std::size_t>;
+};
+
+// Buffers that aren't contiguous as a whole, but give a pointer to the data
+// at an offset, contiguous up to the end of the piece containing it
+template <typename BufferT>
+concept PieceAddressable = requires(const BufferT b, std::size_t offset) {
+    { b.data_at(offset) }
+        -> std::convertible_to<const typename BufferT::value_type*>;
+};
+
+// Buffers loaded region by region (e.g. LazyFileBuffer), contiguous within
+// a region only. PieceTable starts with a piece per region instead of
+// a single one, and pieces are only ever split, so none crosses a boundary.
+template <typename BufferT>
+concept RegionedBuffer = requires(const BufferT b) {
+    { b.region_size() } -> std::convertible_to<std::size_t>;
+};
+
+// Buffers stored as a single array (e.g. std::basic_string), read through
+// data()
+template <typename BufferT>
+concept FlatBuffer = !PieceAddressable<BufferT>
+                     && requires(const BufferT b) {
+    { std::data(b) }
+        -> std::convertible_to<const typename BufferT::value_type*>;
+};
+
+// Buffers whose data never moves once appended (e.g. ChunkedAppendBuffer),
+// so pointers into them stay valid while they grow, and when the buffer
+// itself is moved
+template <typename BufferT>
+concept StableStorage = requires { BufferT::stable_storage; }
+                        && BufferT::stable_storage;
+
+// Iterator to the element at offset in the buffer. Valid to advance
+// through the rest of the piece starting there.
+template <typename BufferT>
+constexpr auto bufferIteratorAt(const BufferT& buffer, std::size_t offset) {
+    if constexpr (PieceAddressable<BufferT>) {
+        return buffer.data_at(offset);
+    }
+    else {
+        return std::begin(buffer) + offset;
+    }
+}
+
+// Appends the range to the buffer, returns where it starts
+template <typename BufferT, typename InputRange>
+constexpr std::size_t appendToBuffer(BufferT& buffer, const InputRange& range) {
+    if constexpr (PieceAppendable<BufferT>) {
+        return buffer.append_piece(std::begin(range), std::end(range));
+    }
+    else {
+        buffer.insert(std::end(buffer), std::begin(range), std::end(range));
+        return std::size(buffer) - std::size(range);
+    }
+}
+
+// Sequence type holding the pieces cut out by an edit. Sequences can ask for
+// a lighter one with undo_sequence_type, when they are never spliced back.
 template <typename PieceSequenceT>
-auto getPositionInTable(PieceSequenceT && pieces, std::size_t idx) {
+struct UndoSequence {
+    using type = PieceSequenceT;
+};
+
+template <typename PieceSequenceT>
+    requires requires { typename PieceSequenceT::undo_sequence_type; }
+struct UndoSequence<PieceSequenceT> {
+    using type = typename PieceSequenceT::undo_sequence_type;
+};
+
+// Allocator of the piece sequence, also used for the sequences in UndoPacks,
+// so that splicing between them is valid for stateful (e.g. std::pmr) ones
+template <typename PieceSequenceT>
+struct PieceAllocator {
+    using type = std::allocator<typename PieceSequenceT::value_type>;
+};
+
+template <typename PieceSequenceT>
+    requires requires { typename PieceSequenceT::allocator_type; }
+struct PieceAllocator<PieceSequenceT> {
+    using type = typename PieceSequenceT::allocator_type;
+};
+
+template <typename PieceSequenceT>
+constexpr auto getPositionInTableLinear(PieceSequenceT && pieces,
+                                        std::size_t idx) {
     auto it = std::begin(pieces);
 
     for (; it != std::end(pieces); ++it) {
@@ -38,19 +148,57 @@ auto getPositionInTable(PieceSequenceT && pieces, std::size_t idx) {
     return PieceTablePosition{idx, it};
 }
 
+// Sequences that can find the piece containing an offset by themselves,
+// faster than a linear scan (e.g. PieceTree)
+template <typename Container>
+concept OffsetSearchable = requires(Container c, std::size_t idx) {
+    { c.find_offset(idx) };
+};
+
+// Sequences keeping a line break count for every piece, summed up over
+// the document (e.g. LineIndexedPieceTree)
+template <typename Container>
+concept LineIndexed = requires { Container::indexes_lines; }
+                      && Container::indexes_lines;
+
+template <typename PieceSequenceT>
+constexpr auto getPositionInTable(PieceSequenceT && pieces, std::size_t idx) {
+    if constexpr (OffsetSearchable<PieceSequenceT>) {
+        return pieces.find_offset(idx);
+    }
+    else {
+        return getPositionInTableLinear(pieces, idx);
+    }
+}
+
+// Usable in constant expressions with buffers and a piece sequence that are,
+// e.g. std::basic_string_view, std::vector and std::vector<Piece>.
+// (std::basic_string can't be moved in, in libstdc++ 12 constant evaluation.)
+//
+// StatsT counts what the hot paths do (see PieceTableCounters), nothing by
+// default.
 template <
     typename OriginalBufferT,
     typename AppendBufferT,
-    typename PieceSequenceT >
+    typename PieceSequenceT,
+    typename StatsT = EmptyLogger >
 class PieceTable {
     static_assert(std::is_same_v<typename OriginalBufferT::value_type,
                                  typename AppendBufferT::value_type>);
-    static_assert(std::is_same_v<typename PieceSequenceT::value_type,
-                                 Piece>);
+    static_assert(std::is_same_v<typename PieceSequenceT::value_type, Piece>
+                  || std::is_same_v<typename PieceSequenceT::value_type,
+                                    CompactPiece>);
 
 public:
     using value_type = OriginalBufferT::value_type;
     using size_type = std::size_t;
+    using allocator_type = typename PieceAllocator<PieceSequenceT>::type;
+    using piece_type = typename PieceSequenceT::value_type;
+
+    static constexpr bool line_indexed = LineIndexed<PieceSequenceT>;
+    // pieces are read without branching on their buffer, see FlatBuffer
+    static constexpr bool flat_buffers = FlatBuffer<OriginalBufferT>
+                                         && FlatBuffer<AppendBufferT>;
 
     using piece_sequence_index = std::conditional_t<
         Splicable<PieceSequenceT>,
@@ -60,7 +208,155 @@ public:
     struct UndoPack {
         piece_sequence_index begin;
         piece_sequence_index end;
-        PieceSequenceT data;
+        typename UndoSequence<PieceSequenceT>::type data;
+        // elements in data and in [begin, end), so undo needn't sum them up
+        size_type data_size = 0;
+        size_type range_size = 0;
+    };
+
+    // One edit of a batch (see apply_edits): delete_count elements at offset
+    // are replaced with text
+    struct Edit {
+        size_type offset;
+        size_type delete_count;
+        std::basic_string_view<value_type> text;
+    };
+
+    // Read-only view of a document range as consecutive chunks, each one
+    // a string_view pointing directly into one of the buffers (one chunk
+    // per piece). Invalidated by any modification of the table.
+    class ChunkRange {
+      public:
+        class iterator {
+          public:
+            using value_type = std::basic_string_view<
+                typename PieceTable::value_type>;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+
+            value_type operator*() const {
+                return table_->piece_view(*it_).substr(
+                    in_piece_offset_, remaining_);
+            }
+
+            iterator& operator++() {
+                remaining_ -= std::min(remaining_,
+                                       it_->size - in_piece_offset_);
+                in_piece_offset_ = 0;
+                ++it_;
+                skip_empty();
+                return *this;
+            }
+            iterator operator++(int) {
+                auto copy = *this;
+                ++*this;
+                return copy;
+            }
+
+            friend bool operator==(const iterator& it, std::default_sentinel_t) {
+                return it.remaining_ == 0;
+            }
+
+          private:
+            friend class PieceTable;
+            using piece_iterator = typename PieceSequenceT::const_iterator;
+
+            iterator(const PieceTable* table, piece_iterator it,
+                     size_type in_piece_offset, size_type remaining)
+                : table_{table}, it_{it}
+                , in_piece_offset_{in_piece_offset}, remaining_{remaining} {
+                skip_empty();
+            }
+
+            void skip_empty() {
+                while (remaining_ > 0 && it_->size == in_piece_offset_) {
+                    in_piece_offset_ = 0;
+                    ++it_;
+                }
+            }
+
+            const PieceTable* table_ = nullptr;
+            piece_iterator it_{};
+            size_type in_piece_offset_ = 0;
+            size_type remaining_ = 0;
+        };
+
+        iterator begin() const { return begin_; }
+        std::default_sentinel_t end() const { return {}; }
+
+      private:
+        friend class PieceTable;
+        explicit ChunkRange(iterator begin) : begin_{begin} {}
+
+        iterator begin_;
+    };
+
+    // Immutable view of the document at the time it was taken, readable from
+    // any thread without locking while the table keeps being edited. It holds
+    // the pieces resolved to pointers into the buffers and never touches
+    // the table again. Valid until the table is destroyed, moved or has its
+    // append buffer compacted.
+    class Snapshot {
+      public:
+        using view_type = std::basic_string_view<value_type>;
+
+        Snapshot() = default;
+
+        [[nodiscard]] size_type size() const { return size_; }
+        [[nodiscard]] bool is_empty() const { return size_ == 0; }
+
+        // The document as consecutive non-empty chunks, one per piece
+        [[nodiscard]] std::span<const view_type> chunks() const {
+            return views_;
+        }
+
+        [[nodiscard]] value_type at(size_type idx) const {
+            assert(idx < size_);
+            const size_type view_index = view_containing(idx);
+            return views_[view_index][idx - starts_[view_index]];
+        }
+
+        void copy_range(size_type idx, size_type count,
+                        std::span<value_type> out_span) const {
+            assert(idx + count <= size_ && out_span.size() >= count);
+            if (count == 0) {
+                return;
+            }
+            size_type copied_count = 0;
+            for (size_type view_index = view_containing(idx);
+                    copied_count < count; ++view_index) {
+                const view_type part = views_[view_index].substr(
+                    idx + copied_count - starts_[view_index],
+                    count - copied_count);
+                part.copy(out_span.data() + copied_count, part.size());
+                copied_count += part.size();
+            }
+        }
+
+        [[nodiscard]] std::basic_string<value_type>
+        substr(size_type idx, size_type count) const {
+            return make_string(count, [&](std::span<value_type> out) {
+                copy_range(idx, count, out);
+            });
+        }
+
+        [[nodiscard]] std::basic_string<value_type> to_string() const {
+            return substr(0, size_);
+        }
+
+      private:
+        friend class PieceTable;
+
+        size_type view_containing(size_type idx) const {
+            return static_cast<size_type>(
+                std::upper_bound(starts_.begin(), starts_.end(), idx)
+                - starts_.begin()) - 1;
+        }
+
+        std::vector<view_type> views_;
+        std::vector<size_type> starts_;  // document offsets of views_
+        size_type size_ = 0;
     };
 
     PieceTable() = default;
@@ -70,165 +366,476 @@ public:
     PieceTable& operator=(PieceTable&&) = default;
     ~PieceTable() = default;
 
-    PieceTable(OriginalBufferT original_buffer)
-        : original_buffer_{original_buffer}
-        , pieces_{{0, std::size(original_buffer), false}}
-        , size_{std::size(original_buffer)} {}
+    // The buffer is moved in, so a non-owning (std::basic_string_view) or
+    // a mapped (MappedFileBuffer) one makes opening a document O(1)
+    constexpr PieceTable(OriginalBufferT original_buffer)
+        : original_buffer_{std::move(original_buffer)}
+        , pieces_{{first_original_piece()}}
+        , size_{std::size(original_buffer_)} {
+        split_original_buffer();
+        index_original_buffer();
+    }
+
+    // Pieces, and the pieces cut out into UndoPacks, are allocated with
+    // allocator, e.g. a std::pmr::polymorphic_allocator over an arena
+    constexpr explicit PieceTable(const allocator_type& allocator)
+        : pieces_(allocator) {}
+
+    constexpr PieceTable(OriginalBufferT original_buffer,
+                         const allocator_type& allocator)
+        : PieceTable{std::move(original_buffer), AppendBufferT{}, allocator} {}
+
+    // Takes an empty append buffer as well, to configure it (e.g. the memory
+    // resource of a ChunkedAppendBuffer)
+    constexpr PieceTable(OriginalBufferT original_buffer,
+                         AppendBufferT append_buffer,
+                         const allocator_type& allocator = allocator_type{})
+        : original_buffer_{std::move(original_buffer)}
+        , append_buffer_{std::move(append_buffer)}
+        , pieces_({first_original_piece()}, allocator)
+        , size_{std::size(original_buffer_)} {
+        assert(std::empty(append_buffer_));
+        split_original_buffer();
+        index_original_buffer();
+    }
+
+    [[nodiscard]] constexpr allocator_type get_allocator() const {
+        if constexpr (requires { pieces_.get_allocator(); }) {
+            return pieces_.get_allocator();
+        }
+        else {
+            return allocator_type{};
+        }
+    }
 
-    [[nodiscard]] bool is_empty() const {
+    [[nodiscard]] constexpr bool is_empty() const {
         return pieces_.empty();
     }
 
-    [[nodiscard]] size_type length() const {
+    [[nodiscard]] constexpr size_type length() const {
         return size();
     }
-    [[nodiscard]] size_type size() const {
+    [[nodiscard]] constexpr size_type size() const {
         return size_;
     }
 
-    void copy_data_to_span(std::span<value_type> out_span) const {
+    // Pieces the document is made of, a measure of its fragmentation
+    [[nodiscard]] constexpr size_type piece_count() const {
+        return std::size(pieces_);
+    }
+
+    // Counted by StatsT since construction or the last reset, all zero
+    // with EmptyLogger
+    [[nodiscard]] constexpr PieceTableCounters counters() const {
+        return stats_.counters();
+    }
+    constexpr void reset_counters() {
+        stats_.reset();
+    }
+
+    // Documents (or searched parts) smaller than that are not worth spinning
+    // up threads for
+    static constexpr size_type parallel_copy_threshold = size_type{1} << 20;
+
+    constexpr void copy_data_to_span(std::span<value_type> out_span) const {
         assert(out_span.size() == size());
         std::size_t copied_count = 0;
 
-        for (const Piece& b : pieces_) {
-            if (b.appended_sequence) {
-                const auto piece_begin = std::begin(append_buffer_) + b.start;
-                const auto piece_end = piece_begin + b.size;
-                std::copy(piece_begin, piece_end,
-                          std::begin(out_span) + copied_count);
-            } else {
-                const auto piece_begin = std::begin(original_buffer_) + b.start;
-                const auto piece_end = piece_begin + b.size;
-                std::copy(piece_begin, piece_end,
-                          std::begin(out_span) + copied_count);
+        for (const piece_type& b : pieces_) {
+            copy_piece_part(b, 0, b.size, out_span.data() + copied_count);
+            copied_count += b.size;
+        }
+    }
+
+    // Same as copy_data_to_span, but the document is cut into thread_count
+    // equally sized byte ranges, copied concurrently. A range may start and
+    // end in the middle of a piece, so even a single huge piece is split.
+    void copy_data_to_span_parallel(std::span<value_type> out_span,
+                                    unsigned thread_count) const {
+        assert(out_span.size() == size());
+        if (thread_count <= 1 || size() < parallel_copy_threshold) {
+            copy_data_to_span(out_span);
+            return;
+        }
+
+        // document offsets of the piece starts, to find where ranges begin
+        std::vector<piece_type> pieces(std::begin(pieces_), std::end(pieces_));
+        std::vector<size_type> offsets;
+        offsets.reserve(pieces.size());
+        size_type offset = 0;
+        for (const piece_type& b : pieces) {
+            offsets.push_back(offset);
+            offset += b.size;
+        }
+
+        const size_type share = (size() + thread_count - 1) / thread_count;
+        run_parallel(thread_count, [&](unsigned thread_index) {
+            size_type first = std::min(size(), thread_index * share);
+            const size_type last = std::min(size(), first + share);
+
+            auto piece_index = static_cast<size_type>(
+                std::upper_bound(offsets.begin(), offsets.end(), first)
+                - offsets.begin()) - 1;
+            while (first < last) {
+                const piece_type& b = pieces[piece_index];
+                const size_type in_piece_offset = first - offsets[piece_index];
+                const size_type count = std::min(b.size - in_piece_offset,
+                                                 last - first);
+                copy_piece_part(b, in_piece_offset, count,
+                                out_span.data() + first);
+                first += count;
+                ++piece_index;
             }
+        });
+    }
 
-            copied_count += b.size;
+    // O(pieces), the text itself isn't copied. Needs an append buffer that
+    // never moves its data, the appended parts the snapshot refers to are
+    // then never written again.
+    [[nodiscard]] Snapshot snapshot() const
+            requires StableStorage<AppendBufferT> {
+        Snapshot snapshot;
+        snapshot.views_.reserve(std::size(pieces_));
+        snapshot.starts_.reserve(std::size(pieces_));
+        for (const piece_type& piece : pieces_) {
+            if (piece.size > 0) {
+                snapshot.views_.push_back(piece_view(piece));
+                snapshot.starts_.push_back(snapshot.size_);
+                snapshot.size_ += piece.size;
+            }
         }
+        return snapshot;
     }
 
-    [[nodiscard]] std::basic_string<value_type> to_string() const {
-        std::basic_string<value_type> result(size(), '\0');
-        copy_data_to_span(std::span{result});
-        return result;
+    // Line queries, for line-indexed piece sequences. Lines are 0-based,
+    // a line break belongs to the line it ends.
+    [[nodiscard]] size_type line_count() const requires line_indexed {
+        return pieces_.total_line_breaks() + 1;
     }
 
-    [[nodiscard]] std::vector<value_type> to_vector() const {
-        std::vector<value_type> result(size(), '\0');
-        copy_data_to_span(std::span{result});
+    // Offset of the first element of the line, O(log n)
+    [[nodiscard]] size_type line_to_offset(size_type line) const
+            requires line_indexed {
+        assert(line < line_count());
+        if (line == 0) {
+            return 0;
+        }
+        // the line starts right after the line break ending the previous one
+        const auto [in_piece_line_break, it]
+            = pieces_.find_line_break(line - 1);
+        const auto& line_breaks = buffer_line_breaks(it->appended_sequence);
+        const auto piece_line_breaks = std::lower_bound(
+            line_breaks.begin(), line_breaks.end(), it->start);
+        return pieces_.offset_of(it)
+               + (piece_line_breaks[in_piece_line_break] - it->start) + 1;
+    }
+
+    // Line containing the element at idx, O(log n)
+    [[nodiscard]] size_type offset_to_line(size_type idx) const
+            requires line_indexed {
+        check_indices(idx);
+        const auto [in_piece_offset, it] = pieces_.find_offset(idx);
+        if (it == std::end(pieces_)) {
+            return pieces_.total_line_breaks();
+        }
+        return pieces_.line_breaks_before(it)
+               + count_line_breaks(it->appended_sequence, it->start,
+                                   it->start + in_piece_offset);
+    }
+
+    // Chunks of the whole document
+    [[nodiscard]] ChunkRange chunks() const {
+        return chunks(0, size());
+    }
+
+    // Chunks of [idx, size())
+    [[nodiscard]] ChunkRange chunks(size_type idx) const {
+        check_indices(idx);
+        return chunks(idx, size() - idx);
+    }
+
+    // Chunks of [idx, idx + count), the first and the last one trimmed
+    [[nodiscard]] ChunkRange chunks(size_type idx, size_type count) const {
+        check_indices(idx, count);
+        const auto [in_piece_offset, it] = find_position(idx);
+        return ChunkRange{typename ChunkRange::iterator{
+            this, it, in_piece_offset, count}};
+    }
+
+    [[nodiscard]] constexpr value_type at(size_type idx) const {
+        assert(idx < size());
+        const auto [in_piece_offset, it] = find_position(idx);
+        value_type element;
+        visit_piece_data(*it, [&](auto first, auto) {
+            element = first[in_piece_offset];
+        });
+        return element;
+    }
+
+    // Copies [idx, idx + count) to the beginning of out_span, touching only
+    // the pieces overlapping the range
+    constexpr void copy_range(size_type idx, size_type count,
+                    std::span<value_type> out_span) const {
+        check_indices(idx, count);
+        assert(out_span.size() >= count);
+        auto [in_piece_offset, it] = find_position(idx);
+
+        size_type copied_count = 0;
+        while (copied_count < count) {
+            const size_type part = std::min(it->size - in_piece_offset,
+                                            count - copied_count);
+            copy_piece_part(*it, in_piece_offset, part,
+                            out_span.data() + copied_count);
+            copied_count += part;
+            in_piece_offset = 0;
+            ++it;
+        }
+    }
+
+    [[nodiscard]] constexpr std::basic_string<value_type>
+    substr(size_type idx, size_type count) const {
+        return make_string(count, [&](std::span<value_type> out) {
+            copy_range(idx, count, out);
+        });
+    }
+
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+    // Offset of the first occurrence of pattern at or after from, or npos.
+    // Searches the buffers in place, matches may span any number of pieces.
+    [[nodiscard]] size_type find(std::basic_string_view<value_type> pattern,
+                                 size_type from = 0) const {
+        if (from > size()) {
+            return npos;
+        }
+        if (pattern.empty()) {
+            return from;
+        }
+        size_type found = npos;
+        search(pattern, from, size(), [&found](size_type offset) {
+            found = offset;
+            return true;
+        });
+        return found;
+    }
+
+    // Offsets of the non-overlapping occurrences of pattern at or after
+    // from, ascending - ready to be turned into edits for apply_edits
+    [[nodiscard]] std::vector<size_type>
+    find_all(std::basic_string_view<value_type> pattern,
+             size_type from = 0) const {
+        std::vector<size_type> found;
+        if (pattern.empty() || from > size()) {
+            return found;
+        }
+        search(pattern, from, size(), [&](size_type offset) {
+            if (found.empty() || offset >= found.back() + pattern.size()) {
+                found.push_back(offset);
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Same as find_all, but the document is cut into thread_count equally
+    // sized ranges of match starts, searched concurrently. The search of
+    // a range reads on past its end, so matches crossing range (and piece)
+    // boundaries are found by the range they start in.
+    [[nodiscard]] std::vector<size_type>
+    find_all_parallel(std::basic_string_view<value_type> pattern,
+                      unsigned thread_count, size_type from = 0) const {
+        if (thread_count <= 1 || pattern.empty() || from > size()
+                || size() - from < parallel_copy_threshold) {
+            return find_all(pattern, from);
+        }
+
+        // all the occurrences of every range, overlapping ones included,
+        // a match can't tell if the previous range ends with an overlapping one
+        std::vector<std::vector<size_type>> range_matches(thread_count);
+        const size_type share = (size() - from + thread_count - 1)
+                                / thread_count;
+        run_parallel(thread_count, [&](unsigned thread_index) {
+            const size_type first = std::min(size(),
+                                             from + thread_index * share);
+            const size_type last = std::min(size(), first + share);
+            search(pattern, first, last, [&](size_type offset) {
+                range_matches[thread_index].push_back(offset);
+                return false;
+            });
+        });
+
+        std::vector<size_type> found;
+        for (const auto& matches : range_matches) {
+            for (const size_type offset : matches) {
+                if (found.empty() || offset >= found.back() + pattern.size()) {
+                    found.push_back(offset);
+                }
+            }
+        }
+        return found;
+    }
+
+    [[nodiscard]] constexpr std::basic_string<value_type> to_string() const {
+        return make_string(size(), [this](std::span<value_type> out) {
+            copy_data_to_span(out);
+        });
+    }
+
+    [[nodiscard]] std::basic_string<value_type>
+    to_string_parallel(unsigned thread_count) const {
+        return make_string(size(), [this, thread_count](std::span<value_type> out) {
+            copy_data_to_span_parallel(out, thread_count);
+        });
+    }
+
+    [[nodiscard]] constexpr std::vector<value_type> to_vector() const {
+        // appending piece by piece into reserved storage, no zero-fill first
+        std::vector<value_type> result;
+        result.reserve(size());
+        for (const piece_type& b : pieces_) {
+            visit_piece_data(b, [&](auto first, auto last) {
+                result.insert(std::end(result), first, last);
+            });
+        }
         return result;
     }
 
-    UndoPack clear() {
+    // Writes the document piece by piece, straight from the buffers, without
+    // building a copy of it first
+    void write_to(std::basic_ostream<value_type>& out) const {
+        for (const piece_type& b : pieces_) {
+            if (b.size > 0) {
+                const auto view = piece_view(b);
+                out.write(view.data(),
+                          static_cast<std::streamsize>(view.size()));
+            }
+        }
+    }
+
+#if __has_include(<sys/uio.h>)
+    // Writes the document to fd with writev, up to IOV_MAX pieces per call,
+    // so the kernel copies the data from the buffers themselves. Throws
+    // std::system_error if writing fails.
+    void write_to(int fd) const {
+        const auto max_iovecs = static_cast<size_type>(
+            std::max(::sysconf(_SC_IOV_MAX), 16L));
+        std::vector<iovec> iovecs;
+        iovecs.reserve(std::min(max_iovecs, std::size(pieces_)));
+        for (const piece_type& b : pieces_) {
+            if (b.size > 0) {
+                const auto view = piece_view(b);
+                iovecs.push_back({const_cast<value_type*>(view.data()),
+                                  view.size() * sizeof(value_type)});
+                if (iovecs.size() == max_iovecs) {
+                    write_iovecs(fd, iovecs);
+                }
+            }
+        }
+        write_iovecs(fd, iovecs);
+    }
+#endif
+
+    constexpr UndoPack clear() {
         size_ = 0;
         return replace_piece_range_with(std::begin(pieces_), std::end(pieces_),
-                                        std::span<Piece>{});
+                                        std::span<piece_type>{}, 0);
     }
 
-    UndoPack insert_at(size_type idx, value_type element) {
+    constexpr UndoPack insert_at(size_type idx, value_type element) {
         std::basic_string_view<value_type> element_view{&element, 1};
         return insert_range_at(idx, element_view);
     }
 
     template<typename InputRange>
-    UndoPack insert_range_at(size_type idx, InputRange&& range) {
+    constexpr UndoPack insert_range_at(size_type idx, InputRange&& range) {
         check_indices(idx);
         if (idx == size_) {
             return append_range(std::forward<InputRange>(range));
         }
 
-        const auto position = getPositionInTable(pieces_, idx);
+        const auto position = locate(idx);
         const std::size_t appended_size = std::size(range);
-        append_buffer_.insert(std::end(append_buffer_),
-                              std::begin(range), std::end(range));
 
-        Piece new_piece {
-            .start = append_buffer_.size() - appended_size,
-            .size = appended_size,
-            .appended_sequence = true
-        };
+        const auto new_piece = makePiece<piece_type>(
+            append_to_buffer(range), appended_size, true);
 
         size_ += appended_size;
 
         if (position.in_piece_offset == 0) {
             // insertion between pieces, no need to split
-            auto it = pieces_.insert(position.it, new_piece);
-            return UndoPack {
-                .begin = it,
-                .end = std::next(it),
-                .data = {},
-            };
+            return insert_piece_before(position.it, new_piece, idx);
         }
         else {
             // insertion in the middle of the piece
             // split the piece, extract the old one, add 3 new
             auto split_piece = split_piece_at(position);
-            Piece inserted[3] {
+            piece_type inserted[3] {
                 split_piece.parts[0],
                 new_piece,
                 split_piece.parts[1]
             };
             return replace_piece_range_with(position.it, std::next(position.it),
-                                            std::span{inserted});
+                                            std::span{inserted},
+                                            idx - position.in_piece_offset);
         }
     }
 
-    UndoPack insert_range_at(size_type idx, const value_type* ptr) {
+    constexpr UndoPack insert_range_at(size_type idx,
+                                       const value_type* ptr) {
         return insert_range_at(idx, std::basic_string_view{ptr});
     }
 
-    UndoPack insert_range_at(size_type idx,
-                             const std::basic_string<value_type>& str) {
+    constexpr UndoPack
+    insert_range_at(size_type idx, const std::basic_string<value_type>& str) {
         return insert_range_at(idx, std::basic_string_view{str});
     }
 
-    UndoPack append(value_type element) {
+    constexpr UndoPack append(value_type element) {
         std::basic_string_view<value_type> element_view{&element, 1};
         return append_range(element_view);
     }
 
     template<typename InputRange>
-    UndoPack append_range(InputRange&& range) {
+    constexpr UndoPack append_range(InputRange&& range) {
         const std::size_t appended_size = std::size(range);
 
-        append_buffer_.insert(std::end(append_buffer_),
-                              std::begin(range), std::end(range));
-        Piece new_piece {
-            .start = append_buffer_.size() - appended_size,
-            .size = appended_size,
-            .appended_sequence = true
-        };
-        auto inserted = pieces_.insert(std::end(pieces_), new_piece);
-
+        const auto new_piece = makePiece<piece_type>(
+            append_to_buffer(range), appended_size, true);
         size_ += appended_size;
 
-        return UndoPack {
-            .begin = inserted,
-            .end = std::next(inserted),
-            .data = {}
-        };
+        return insert_piece_before(std::end(pieces_), new_piece,
+                                   size_ - appended_size);
     }
 
-    UndoPack append_range(const value_type* ptr) {
+    constexpr UndoPack append_range(const value_type* ptr) {
         return append_range(std::basic_string_view{ptr});
     }
 
-    UndoPack append_range(const std::basic_string<value_type>& str) {
+    constexpr UndoPack
+    append_range(const std::basic_string<value_type>& str) {
         return append_range(std::basic_string_view{str});
     }
 
-    UndoPack delete_at(size_type idx) {
+    constexpr UndoPack delete_at(size_type idx) {
         return delete_range_at(idx, 1);
     }
 
-    UndoPack delete_range_at(size_type idx, size_type count) {
+    constexpr UndoPack delete_range_at(size_type idx, size_type count) {
         check_indices(idx, count);
         size_ -= count;
-        auto [in_piece_offset, piece_it] = getPositionInTable(pieces_, idx);
+        auto [in_piece_offset, piece_it] = locate(idx);
+        const size_type range_begin_offset = idx - in_piece_offset;
+
+        if (count == 0) {
+            // nothing to cut, an empty range would drop the split-off part
+            return replace_piece_range_with(piece_it, piece_it,
+                                            std::span<piece_type>{},
+                                            range_begin_offset);
+        }
 
         // [ 0 ] - [ 1 ] - [ 2 ] - [ 3 ] - [ 4 ] - [ 5 ]
 
-        Piece cut_border_pieces[2]; // intentionally uninitialized
+        piece_type cut_border_pieces[2]; // intentionally uninitialized
         auto cut_begin = cut_border_pieces + 0;
         auto cut_end = cut_border_pieces + 2;
 
@@ -257,7 +864,7 @@ public:
         }
 
         // go past all the pieces that are fully deleted
-        while (count >= piece_it->size) {
+        while (piece_it != std::end(pieces_) && count >= piece_it->size) {
             count -= piece_it->size;
             ++piece_it;
         }
@@ -285,13 +892,94 @@ public:
         // undo.begin^             ^undo.end
 
         return replace_piece_range_with(range_begin, range_end,
-                                        std::span(cut_begin, cut_end));
+                                        std::span(cut_begin, cut_end),
+                                        range_begin_offset);
+    }
+
+    // Applies a batch of edits (e.g. one per cursor) in a single forward
+    // sweep over the pieces, as one UndoPack. Offsets refer to the document
+    // before the batch, edits are sorted by offset and don't overlap.
+    // The pieces between the first and the last edit are replaced as a whole,
+    // so the UndoPack holds all of them.
+    constexpr UndoPack apply_edits(std::span<const Edit> edits) {
+        if (edits.empty()) {
+            return delete_range_at(0, 0);
+        }
+        for (size_type i = 0; i < edits.size(); ++i) {
+            check_indices(edits[i].offset, edits[i].delete_count);
+            assert(i == 0 || edits[i - 1].offset + edits[i - 1].delete_count
+                             <= edits[i].offset);
+        }
+
+        auto [in_piece_offset, it] = locate(edits.front().offset);
+        const auto range_begin = it;
+        // document offset of the start of *it, and of the sweep
+        const size_type range_begin_offset
+            = edits.front().offset - in_piece_offset;
+        size_type piece_start = range_begin_offset;
+        size_type position = piece_start;
+
+        size_type new_size = size_;  // kept if appending throws
+        std::vector<piece_type> replacement;
+        replacement.reserve(2 * edits.size() + 1);
+
+        // moves the sweep to target, keeping the swept over text or not
+        const auto sweep_to = [&](size_type target, bool keep) {
+            while (position < target) {
+                const size_type piece_end = piece_start + it->size;
+                const size_type part_end = std::min(piece_end, target);
+                if (keep && part_end > position) {
+                    replacement.push_back(makePiece<piece_type>(
+                        it->start + (position - piece_start),
+                        part_end - position, it->appended_sequence));
+                }
+                position = part_end;
+                if (position < piece_end) {
+                    // the sweep stops inside the piece
+                    stats_.count_split();
+                }
+                if (position == piece_end) {
+                    piece_start = piece_end;
+                    ++it;
+                }
+            }
+        };
+
+        for (const Edit& edit : edits) {
+            sweep_to(edit.offset, true);
+            if (!edit.text.empty()) {
+                const auto inserted = makePiece<piece_type>(
+                    append_to_buffer(edit.text), edit.text.size(), true);
+                // text typed right after the previous edit's, same as
+                // insert_piece_before does
+                if (!replacement.empty()
+                        && continues(replacement.back(), inserted)) {
+                    replacement.back().size += inserted.size;
+                }
+                else {
+                    replacement.push_back(inserted);
+                }
+            }
+            sweep_to(edit.offset + edit.delete_count, false);
+            new_size = new_size - edit.delete_count + edit.text.size();
+        }
+        size_ = new_size;
+
+        // the sweep stopped in the middle of a piece, keep its rest too
+        if (position != piece_start) {
+            sweep_to(piece_start + it->size, true);
+        }
+
+        return replace_piece_range_with(range_begin, it, replacement,
+                                        range_begin_offset);
     }
 
-    UndoPack undo(UndoPack&& undo) {
-        const size_type undo_length = get_part_size(std::begin(undo.data),
-                                                    std::end(undo.data));
-        UndoPack redo;
+    // Reverts the edit that returned the pack, which has to be the latest
+    // one not undone yet, and returns the pack redoing it. O(1) for
+    // splicable sequences.
+    constexpr UndoPack undo(UndoPack&& undo) {
+        const size_type restored_count = std::size(undo.data);
+        UndoPack redo = make_undo_pack();
         if constexpr (Splicable<PieceSequenceT>) {
             // undo.begin, undo.end are persistent iterators to pieces_
             redo.data.splice(std::end(redo.data), pieces_, undo.begin, undo.end);
@@ -303,30 +991,581 @@ public:
             pieces_.splice(undo.end, undo.data);
             redo.end = undo.end;
         }
+        else if constexpr (IndexReplaceable<PieceSequenceT>) {
+            // undo.begin, undo.end are indices, the range is replaced back
+            // in place, exactly like a regular edit
+            redo = replace_piece_range_with(piece_at(undo.begin),
+                                            piece_at(undo.end),
+                                            undo.data, 0);
+        }
         else {
-            redo = replace_piece_range_with(redo.begin, redo.end, redo.data);
+            // undo.begin, undo.end are indices. The range is swapped with
+            // undo.data, whose storage then holds the redo pieces, so no
+            // new sequence is allocated.
+            const size_type old_count = undo.end - undo.begin;
+            const size_type new_count = std::size(undo.data);
+            const size_type common_count = std::min(old_count, new_count);
+            const auto begin = piece_at(undo.begin);
+            const auto common_end = std::next(begin, common_count);
+            const auto data_common_end = std::next(std::begin(undo.data),
+                                                   common_count);
+            std::swap_ranges(begin, common_end, std::begin(undo.data));
+            if (new_count > old_count) {
+                pieces_.insert(common_end, data_common_end,
+                               std::end(undo.data));
+                undo.data.erase(data_common_end, std::end(undo.data));
+            }
+            else {
+                const auto end = std::next(begin, old_count);
+                undo.data.insert(std::end(undo.data), common_end, end);
+                pieces_.erase(common_end, end);
+            }
+            redo.begin = undo.begin;
+            redo.end = undo.begin + new_count;
+            redo.data = std::move(undo.data);
         }
+        // the offset of the restored range is unknown
+        last_position_.reset();
 
-        size_ = size_ + undo_length - get_part_size(std::begin(redo.data),
-                                                    std::end(redo.data));
+        if constexpr (!IndexReplaceable<PieceSequenceT>) {
+            // replace_piece_range_with counts the others
+            stats_.count_splice(restored_count + std::size(redo.data));
+            stats_.count_undo_pack(std::size(redo.data) * sizeof(piece_type));
+        }
+        size_ = size_ + undo.data_size - undo.range_size;
+        redo.data_size = undo.range_size;
+        redo.range_size = undo.data_size;
         return redo;
     }
 
+    // Elements of appended text the pieces of the pack refer to and the
+    // pieces replacing them (its [begin, end) range) don't, i.e. text the
+    // pack alone keeps from being garbage. The pack has to be the latest one
+    // applied, e.g. a pack holding a piece grown by coalescing only counts
+    // the growth.
+    [[nodiscard]] size_type undo_only_size(const UndoPack& undo) const {
+        using Range = std::pair<size_type, size_type>;
+        // appended [start, end) ranges of the replacing pieces. Edits replace
+        // a handful of pieces, they're kept inline, only batches of edits
+        // can spill over to the heap.
+        constexpr size_type inline_capacity = 4;
+        std::array<Range, inline_capacity> inline_live;
+        size_type inline_count = 0;
+        std::vector<Range> spilled_live;
+        auto it = const_piece_at(undo.begin);
+        const auto end = const_piece_at(undo.end);
+        for (; it != end; ++it) {
+            if (!it->appended_sequence || it->size == 0) {
+                continue;
+            }
+            const Range range{it->start, size_type{it->start} + it->size};
+            if (inline_count < inline_capacity) {
+                inline_live[inline_count++] = range;
+                continue;
+            }
+            if (spilled_live.empty()) {
+                spilled_live.assign(inline_live.begin(), inline_live.end());
+            }
+            spilled_live.push_back(range);
+        }
+        const std::span<Range> live = spilled_live.empty()
+            ? std::span<Range>{inline_live.data(), inline_count}
+            : std::span<Range>{spilled_live};
+        std::sort(live.begin(), live.end());
+
+        size_type undo_only = 0;
+        for (const piece_type& piece : undo.data) {
+            if (!piece.appended_sequence) {
+                continue;
+            }
+            size_type position = piece.start;
+            const size_type piece_end = size_type{piece.start} + piece.size;
+            auto range = std::upper_bound(
+                live.begin(), live.end(), position,
+                [](size_type p, const Range& r) { return p < r.second; });
+            for (; range != live.end() && position < piece_end; ++range) {
+                undo_only += std::min(range->first, piece_end)
+                             - std::min(range->first, position);
+                position = std::max(position, range->second);
+            }
+            undo_only += piece_end - std::min(piece_end, position);
+        }
+        return undo_only;
+    }
+
+    // Logical size of the append buffer, including text no longer referenced
+    [[nodiscard]] constexpr size_type append_buffer_size() const {
+        return std::size(append_buffer_);
+    }
+
+    // Rebuilds the append buffer with only the text still referenced by the
+    // pieces of the document and of the given UndoPack ranges (the retained
+    // undo/redo history), and rebases the pieces onto it. Text referenced
+    // only by the UndoPacks left out is dropped, so they become unusable.
+    // Returns the replaced buffer, which snapshots taken before still point
+    // into.
+    //
+    //   before: [ live | deleted, history dropped | live | undo-only ]
+    //   after:  [ live | live | undo-only ]
+    template <typename... UndoPackRanges>
+    AppendBufferT compact_append_buffer(UndoPackRanges&... histories) {
+        // referenced [start, end) ranges, overlapping ones merged, each
+        // with the offset it is moved to
+        struct KeptRange {
+            size_type start;
+            size_type end;
+            size_type new_start;
+        };
+        std::vector<KeptRange> kept;
+        const auto collect = [&kept](const piece_type& piece) {
+            if (piece.appended_sequence && piece.size > 0) {
+                kept.push_back(
+                    {piece.start, size_type{piece.start} + piece.size, 0});
+            }
+        };
+        for (const piece_type& piece : pieces_) {
+            collect(piece);
+        }
+        (for_each_undo_piece(histories, collect), ...);
+
+        std::sort(kept.begin(), kept.end(),
+                  [](const KeptRange& a, const KeptRange& b) {
+                      return a.start < b.start;
+                  });
+        auto merged_end = kept.begin();
+        for (const KeptRange& range : kept) {
+            if (merged_end != kept.begin()
+                    && range.start <= std::prev(merged_end)->end) {
+                std::prev(merged_end)->end = std::max(
+                    std::prev(merged_end)->end, range.end);
+            }
+            else {
+                *merged_end++ = range;
+            }
+        }
+        kept.erase(merged_end, kept.end());
+
+        // the moved-from buffer is cleared, so it keeps its configuration
+        // (e.g. the memory resource of a ChunkedAppendBuffer)
+        AppendBufferT old_buffer = std::move(append_buffer_);
+        append_buffer_.clear();
+        append_line_breaks_.clear();
+        if constexpr (requires { append_buffer_.reserve(size_type{}); }) {
+            size_type kept_size = 0;
+            for (const KeptRange& range : kept) {
+                kept_size += range.end - range.start;
+            }
+            append_buffer_.reserve(kept_size);
+        }
+        for (KeptRange& range : kept) {
+            const auto first = bufferIteratorAt(old_buffer, range.start);
+            range.new_start = append_to_buffer(std::ranges::subrange(
+                first, first + (range.end - range.start)));
+        }
+
+        const auto rebase = [&kept](piece_type& piece) {
+            if (!piece.appended_sequence || piece.size == 0) {
+                return;
+            }
+            const auto range = std::prev(std::upper_bound(
+                kept.begin(), kept.end(), piece.start,
+                [](size_type start, const KeptRange& r) {
+                    return start < r.start;
+                }));
+            piece.start = range->new_start + (piece.start - range->start);
+        };
+        if constexpr (std::is_assignable_v<
+                          decltype((std::begin(pieces_)->start)), size_type>) {
+            // in place, UndoPacks may hold iterators to the pieces
+            for (piece_type& piece : pieces_) {
+                rebase(piece);
+            }
+        }
+        else {
+            // read-only pieces (PieceBTree), indexed UndoPacks stay valid
+            // as long as the piece count doesn't change
+            std::vector<piece_type> rebased(std::begin(pieces_),
+                                            std::end(pieces_));
+            for (piece_type& piece : rebased) {
+                rebase(piece);
+            }
+            pieces_.replace(0, std::size(pieces_),
+                            rebased.begin(), rebased.end());
+        }
+        (for_each_undo_piece(histories, rebase), ...);
+        return old_buffer;
+    }
+
 private:
+    // Calls f(offset) for the occurrences of the non-empty pattern starting
+    // in [first, last), in order, until f returns true. Candidates are found
+    // with a vectorized first + last element scan of every chunk, the ones
+    // running out of their chunk are verified against the next chunks.
+    template <typename F>
+    void search(std::basic_string_view<value_type> pattern, size_type first,
+                size_type last, F&& f) const {
+        assert(!pattern.empty());
+        if (first >= last) {
+            return;
+        }
+        const size_type pattern_size = pattern.size();
+        size_type chunk_offset = first;
+        for (auto chunk_it = chunks(first).begin();
+                chunk_it != std::default_sentinel && chunk_offset < last;
+                ++chunk_it) {
+            const auto chunk = *chunk_it;
+            // match starts in this chunk and before last
+            const size_type starts = std::min(chunk.size(), last - chunk_offset);
+
+            // matches within the chunk
+            const bool stopped = simd_scan::for_each_candidate(
+                chunk.data(),
+                std::min(chunk.size(), starts + pattern_size - 1),
+                pattern_size - 1, pattern.front(), pattern.back(),
+                [&](size_type i) {
+                    return chunk.substr(i, pattern_size) == pattern
+                           && f(chunk_offset + i);
+                });
+            if (stopped) {
+                return;
+            }
+
+            // matches running into the next chunks
+            const size_type crossing_first = chunk.size() >= pattern_size
+                                             ? chunk.size() - pattern_size + 1
+                                             : 0;
+            for (size_type i = crossing_first; i < starts; ++i) {
+                if (chunk[i] == pattern.front()
+                        && matches_across(chunk_it, i, pattern)
+                        && f(chunk_offset + i)) {
+                    return;
+                }
+            }
+            chunk_offset += chunk.size();
+        }
+    }
+
+    // Whether the document continues with pattern from in_chunk_offset of
+    // the chunk at it, through the following chunks
+    static bool matches_across(typename ChunkRange::iterator it,
+                               size_type in_chunk_offset,
+                               std::basic_string_view<value_type> pattern) {
+        auto chunk = (*it).substr(in_chunk_offset);
+        while (true) {
+            const size_type compared = std::min(chunk.size(), pattern.size());
+            if (chunk.substr(0, compared) != pattern.substr(0, compared)) {
+                return false;
+            }
+            pattern.remove_prefix(compared);
+            if (pattern.empty()) {
+                return true;
+            }
+            if (++it == std::default_sentinel) {
+                return false;
+            }
+            chunk = *it;
+        }
+    }
+
+    // Appends the range to the append buffer, returns where it starts.
+    // Throws std::length_error if the piece type can't address it, the table
+    // is left unchanged then.
+    template <typename InputRange>
+    constexpr size_type append_to_buffer(const InputRange& range) {
+        const auto count = static_cast<size_type>(std::size(range));
+        if (count > piece_type::max_size) {
+            throw std::length_error("PieceTable: insertion too long for "
+                                    "the piece type");
+        }
+        const size_type start = appendToBuffer(append_buffer_, range);
+        stats_.count_append(count);
+        if (start > piece_type::max_end - count) {
+            throw std::length_error("PieceTable: append buffer too large "
+                                    "for the piece type");
+        }
+        if constexpr (line_indexed) {
+            index_line_breaks(append_buffer_, start, std::size(range),
+                              append_line_breaks_);
+        }
+        return start;
+    }
+
+    // The original buffer is cut into pieces of at most this size, see
+    // CompactPiece and RegionedBuffer
+    constexpr size_type original_piece_size() const {
+        size_type piece_size = piece_type::max_size;
+        if constexpr (RegionedBuffer<OriginalBufferT>) {
+            piece_size = std::min(piece_size, original_buffer_.region_size());
+        }
+        return piece_size;
+    }
+
+    constexpr piece_type first_original_piece() const {
+        return makePiece<piece_type>(
+            0, std::min(std::size(original_buffer_), original_piece_size()),
+            false);
+    }
+
+    // Adds the pieces of the original buffer after the first one
+    constexpr void split_original_buffer() {
+        if (size_ > piece_type::max_end) {
+            throw std::length_error("PieceTable: original buffer too large "
+                                    "for the piece type");
+        }
+        const size_type piece_size = original_piece_size();
+        if (size_ <= piece_size) {
+            return;
+        }
+        std::vector<piece_type> rest;
+        rest.reserve((size_ - 1) / piece_size);
+        for (size_type start = piece_size; start < size_; start += piece_size) {
+            rest.push_back(makePiece<piece_type>(
+                start, std::min(piece_size, size_ - start), false));
+        }
+        replace_piece_range_with(std::end(pieces_), std::end(pieces_), rest,
+                                 piece_size);
+    }
+
+    constexpr void index_original_buffer() {
+        if constexpr (line_indexed) {
+            // piece by piece, a RegionedBuffer is contiguous within each
+            for (const piece_type& piece : pieces_) {
+                index_line_breaks(original_buffer_, piece.start, piece.size,
+                                  original_line_breaks_);
+            }
+            for (auto it = std::begin(pieces_); it != std::end(pieces_); ++it) {
+                pieces_.set_line_breaks(it, count_line_breaks(*it));
+            }
+        }
+    }
+
+    // Appends the offsets of the line breaks in [start, start + count)
+    // of the buffer to line_breaks
+    template <typename BufferT>
+    static void index_line_breaks(const BufferT& buffer, size_type start,
+                                  size_type count,
+                                  std::vector<size_type>& line_breaks) {
+        const auto first = bufferIteratorAt(buffer, start);
+        const auto line_break = static_cast<value_type>('\n');
+        if constexpr (std::contiguous_iterator<decltype(first)>) {
+            simd_scan::for_each_equal(std::to_address(first), count,
+                                      line_break, [&](size_type i) {
+                line_breaks.push_back(start + i);
+            });
+        }
+        else {
+            for (size_type i = 0; i < count; ++i) {
+                if (first[i] == line_break) {
+                    line_breaks.push_back(start + i);
+                }
+            }
+        }
+    }
+
+    const std::vector<size_type>& buffer_line_breaks(bool appended) const {
+        return appended ? append_line_breaks_ : original_line_breaks_;
+    }
+
+    // Line breaks in [first, last) of the buffer, O(log n)
+    size_type count_line_breaks(bool appended, size_type first,
+                                size_type last) const {
+        const auto& line_breaks = buffer_line_breaks(appended);
+        return static_cast<size_type>(
+            std::lower_bound(line_breaks.begin(), line_breaks.end(), last)
+            - std::lower_bound(line_breaks.begin(), line_breaks.end(), first));
+    }
+
+    size_type count_line_breaks(const piece_type& piece) const {
+        return count_line_breaks(piece.appended_sequence, piece.start,
+                                 size_type{piece.start} + piece.size);
+    }
+
+    template <typename UndoPackRange, typename F>
+    static void for_each_undo_piece(UndoPackRange& undo_packs, const F& f) {
+        for (auto& undo_pack : undo_packs) {
+            for (piece_type& piece : undo_pack.data) {
+                f(piece);
+            }
+        }
+    }
+
+    // Data of the piece, straight from its buffer
+    constexpr std::basic_string_view<value_type>
+    piece_view(const piece_type& piece) const {
+        if constexpr (flat_buffers) {
+            return {flat_piece_data(piece), piece.size};
+        }
+        else if (piece.appended_sequence) {
+            return {std::to_address(bufferIteratorAt(append_buffer_,
+                                                     piece.start)),
+                    piece.size};
+        }
+        else {
+            return {std::to_address(bufferIteratorAt(original_buffer_,
+                                                     piece.start)),
+                    piece.size};
+        }
+    }
+
+    // Both buffers are single arrays, indexing their starts by the flag
+    // replaces the branch on it
+    constexpr const value_type* flat_piece_data(const piece_type& piece) const
+            requires flat_buffers {
+        const value_type* const buffers[2] = {std::data(original_buffer_),
+                                              std::data(append_buffer_)};
+        return buffers[piece.appended_sequence] + piece.start;
+    }
+
+    // Calls f with the [first, last) iterators of the piece in its buffer
+    template <typename F>
+    constexpr void visit_piece_data(const piece_type& piece, F&& f) const {
+        if constexpr (flat_buffers) {
+            const value_type* const first = flat_piece_data(piece);
+            f(first, first + piece.size);
+        }
+        else if (piece.appended_sequence) {
+            const auto first = bufferIteratorAt(append_buffer_, piece.start);
+            f(first, first + piece.size);
+        }
+        else {
+            const auto first = bufferIteratorAt(original_buffer_,
+                                                piece.start);
+            f(first, first + piece.size);
+        }
+    }
+
+    // Copies count elements of the piece, starting at in_piece_offset
+    constexpr void copy_piece_part(const piece_type& piece,
+                                   size_type in_piece_offset, size_type count,
+                                   value_type* out) const {
+        visit_piece_data(piece, [&](auto first, auto) {
+            using BufferIt = decltype(first);
+            if constexpr (std::contiguous_iterator<BufferIt>
+                          && std::is_trivially_copyable_v<value_type>) {
+                if (std::is_constant_evaluated()) {
+                    std::copy_n(first + in_piece_offset, count, out);
+                    return;
+                }
+                if (count == 0) {
+                    // empty buffers may have no storage (nullptr) at all
+                    return;
+                }
+                std::memcpy(out, std::to_address(first) + in_piece_offset,
+                            count * sizeof(value_type));
+            }
+            else {
+                std::copy_n(first + in_piece_offset, count, out);
+            }
+        });
+    }
+
+    // Builds a string of count elements filled by copy, without
+    // zero-filling it first where the library allows it
+    template <typename CopyF>
+    static constexpr std::basic_string<value_type>
+    make_string(size_type count, CopyF copy) {
+        std::basic_string<value_type> result;
+#if defined(__cpp_lib_string_resize_and_overwrite)
+        result.resize_and_overwrite(count, [&](value_type* data,
+                                               size_type n) {
+            copy(std::span{data, n});
+            return n;
+        });
+#else
+        result.resize(count);
+        copy(std::span{result});
+#endif
+        return result;
+    }
+
+#if __has_include(<sys/uio.h>)
+    // Writes all of iovecs, retrying after partial writes, and clears it
+    static void write_iovecs(int fd, std::vector<iovec>& iovecs) {
+        iovec* first = iovecs.data();
+        iovec* const last = iovecs.data() + iovecs.size();
+        while (first != last) {
+            const ssize_t written = ::writev(
+                fd, first, static_cast<int>(last - first));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(),
+                                        "writev");
+            }
+            // skip what was written, the kernel may stop anywhere
+            auto remaining = static_cast<size_type>(written);
+            while (first != last && remaining >= first->iov_len) {
+                remaining -= first->iov_len;
+                ++first;
+            }
+            if (first != last) {
+                first->iov_base = static_cast<char*>(first->iov_base)
+                                  + remaining;
+                first->iov_len -= remaining;
+            }
+        }
+        iovecs.clear();
+    }
+#endif
+
+    // Runs f(0) ... f(thread_count - 1) concurrently, f(0) on this thread
+    template <typename F>
+    static void run_parallel(unsigned thread_count, F&& f) {
+        std::vector<std::jthread> threads;
+        threads.reserve(thread_count - 1);
+        for (unsigned i = 1; i < thread_count; ++i) {
+            threads.emplace_back([&f, i] { f(i); });
+        }
+        f(0);
+    }
+
     using position_type = PieceTablePosition<typename PieceSequenceT::iterator>;
 
+    // A piece and the document offset it starts at. Copies and moves of
+    // the table start without one, the iterator would refer to the source.
+    class PositionCache {
+      public:
+        PositionCache() = default;
+        constexpr PositionCache(const PositionCache&) {}
+        constexpr PositionCache& operator=(const PositionCache&) {
+            reset();
+            return *this;
+        }
+
+        [[nodiscard]] constexpr bool valid() const { return valid_; }
+        [[nodiscard]] constexpr PieceSequenceT::iterator it() const {
+            return it_;
+        }
+        [[nodiscard]] constexpr size_type piece_start() const {
+            return piece_start_;
+        }
+
+        constexpr void set(PieceSequenceT::iterator it, size_type piece_start) {
+            it_ = it;
+            piece_start_ = piece_start;
+            valid_ = true;
+        }
+        constexpr void reset() { valid_ = false; }
+
+      private:
+        PieceSequenceT::iterator it_{};
+        size_type piece_start_ = 0;
+        bool valid_ = false;
+    };
+
     struct SplitBlock {
-        Piece parts[2];
+        piece_type parts[2];
     };
 
-    void check_indices(size_type idx, size_type count = 0) const {
+    constexpr void check_indices(size_type idx, size_type count = 0) const {
         assert(idx <= size_);
         assert(count <= size_);
         assert(idx + count <= size_);
     }
 
     template <typename PieceIt>
-    size_type get_part_size(PieceIt begin, PieceIt end) const {
+    constexpr size_type get_part_size(PieceIt begin, PieceIt end) const {
         size_type size = 0;
         for (auto it = begin; it != end; ++it) {
             size += it->size;
@@ -334,12 +1573,18 @@ private:
         return size;
     }
 
+    // begin_offset is the document offset of begin, where the next lookup
+    // starts from (edits tend to be close to each other)
     template <typename Range>
-    UndoPack replace_piece_range_with(
+    constexpr UndoPack replace_piece_range_with(
             PieceSequenceT::iterator begin,
             PieceSequenceT::iterator end,
-            Range&& elements) {
-        UndoPack undo;
+            Range&& elements,
+            size_type begin_offset) {
+        UndoPack undo = make_undo_pack();
+        undo.data_size = get_part_size(begin, end);
+        undo.range_size = get_part_size(std::begin(elements),
+                                        std::end(elements));
 
         if constexpr (Splicable<PieceSequenceT>) {
             // it's a splicable sequence (likely a list),
@@ -348,46 +1593,206 @@ private:
             // save iterators as undo/redo boundaries (they are not invalidated)
             undo.begin = pieces_.insert(end, std::begin(elements), std::end(elements));
             undo.end = end;
+            if constexpr (line_indexed) {
+                // the cut out pieces keep their counts, for undo
+                for (auto it = undo.begin; it != undo.end; ++it) {
+                    pieces_.set_line_breaks(it, count_line_breaks(*it));
+                }
+            }
+        }
+        else if constexpr (IndexReplaceable<PieceSequenceT>) {
+            // it's an indexed tree (PieceBTree), copy the removed pieces out
+            // and replace the range in place, addressed by piece indices
+            undo.data.assign(begin, end);
+            undo.begin = pieces_.index_of(begin);
+            undo.end = undo.begin + std::size(elements);
+            pieces_.replace(undo.begin, pieces_.index_of(end),
+                            std::begin(elements), std::end(elements));
         }
         else {
-            // it's a different kind of sequence, random access (vector/deque?)
+            // it's a random access sequence (vector/deque),
             // let's just copy the removed piece range out
             undo.data.assign(begin, end);
             // save indices as undo/redo boundaries
-            undo.begin = pieces_.erase(begin, end) - std::begin(pieces_);
-            pieces_.insert(std::begin(pieces_) + undo.begin, end,
-                           std::begin(elements), std::end(elements));
-            undo.end = begin + std::size(elements);
+            undo.begin = begin - std::begin(pieces_);
+            undo.end = undo.begin + std::size(elements);
+
+            // overwrite the common part in place, so that the tail of the
+            // sequence is moved only once, by a single insert or erase
+            const auto old_count = static_cast<size_type>(end - begin);
+            const auto new_count = static_cast<size_type>(std::size(elements));
+            const auto common_count = std::min(old_count, new_count);
+            const auto common_end = std::next(std::begin(elements),
+                                              common_count);
+            const auto overwritten_end = std::copy(std::begin(elements),
+                                                   common_end, begin);
+            if (new_count > old_count) {
+                pieces_.insert(overwritten_end, common_end, std::end(elements));
+            }
+            else {
+                pieces_.erase(overwritten_end, end);
+            }
         }
 
+        if constexpr (!OffsetSearchable<PieceSequenceT>) {
+            // pieces before begin are untouched, so begin_offset is still
+            // the offset of the first replacement piece
+            last_position_.set(piece_at(undo.begin), begin_offset);
+        }
+        stats_.count_splice(std::size(undo.data) + std::size(elements));
+        stats_.count_undo_pack(std::size(undo.data) * sizeof(piece_type));
         return undo;
     }
 
+    // UndoPack with an empty data sequence using the allocator of pieces_
+    constexpr UndoPack make_undo_pack() const {
+        using UndoSequenceT = typename UndoSequence<PieceSequenceT>::type;
+        if constexpr (std::is_constructible_v<UndoSequenceT, allocator_type>) {
+            return UndoPack{.begin = {}, .end = {},
+                            .data = UndoSequenceT(get_allocator())};
+        }
+        else {
+            return UndoPack{};
+        }
+    }
+
+    // Converts index-based UndoPack boundaries back to iterators
+    constexpr PieceSequenceT::iterator
+    piece_at(piece_sequence_index index) {
+        if constexpr (Splicable<PieceSequenceT>) {
+            return index;
+        }
+        else if constexpr (IndexReplaceable<PieceSequenceT>) {
+            return pieces_.nth(index);
+        }
+        else {
+            return std::begin(pieces_) + index;
+        }
+    }
+
+    constexpr PieceSequenceT::const_iterator
+    const_piece_at(piece_sequence_index index) const {
+        if constexpr (Splicable<PieceSequenceT>) {
+            return index;
+        }
+        else if constexpr (IndexReplaceable<PieceSequenceT>) {
+            return pieces_.nth(index);
+        }
+        else {
+            return std::begin(pieces_) + index;
+        }
+    }
+
+    // Piece containing idx, same as getPositionInTable. Sequences without
+    // a search of their own walk there from the last edited piece instead of
+    // from the beginning, so local edits cost O(distance in pieces).
+    constexpr auto locate(size_type idx) {
+        if constexpr (OffsetSearchable<PieceSequenceT>) {
+            stats_.count_lookup(0);
+            return getPositionInTable(pieces_, idx);
+        }
+        else {
+            auto it = std::begin(pieces_);
+            size_type piece_start = 0;
+            if (last_position_.valid()) {
+                it = last_position_.it();
+                piece_start = last_position_.piece_start();
+            }
+            size_type scanned = 0;
+            while (idx < piece_start) {
+                --it;
+                piece_start -= it->size;
+                ++scanned;
+            }
+            while (it != std::end(pieces_) && idx >= piece_start + it->size) {
+                piece_start += it->size;
+                ++it;
+                ++scanned;
+            }
+            stats_.count_lookup(scanned);
+            last_position_.set(it, piece_start);
+            return position_type{idx - piece_start, it};
+        }
+    }
+
+    // getPositionInTable for the reads, counted by StatsT
+    constexpr auto find_position(size_type idx) const {
+        if constexpr (OffsetSearchable<PieceSequenceT>) {
+            stats_.count_lookup(0);
+            return getPositionInTable(pieces_, idx);
+        }
+        else {
+            auto it = std::begin(pieces_);
+            size_type scanned = 0;
+            for (; it != std::end(pieces_) && it->size <= idx; ++it) {
+                idx -= it->size;
+                ++scanned;
+            }
+            stats_.count_lookup(scanned);
+            return PieceTablePosition{idx, it};
+        }
+    }
+
+
+    // Inserts the new piece before pos. If the new text directly follows
+    // the piece before pos in the append buffer (e.g. continuous typing),
+    // that piece grows instead, so the piece count doesn't grow with
+    // keystrokes. The grown piece replaces the old one, which is kept in
+    // the UndoPack, so undo restores the exact previous state.
+    constexpr UndoPack insert_piece_before(PieceSequenceT::iterator pos,
+                                           const piece_type& new_piece,
+                                           size_type pos_offset) {
+        if (pos != std::begin(pieces_)) {
+            const auto prev = std::prev(pos);
+            if (continues(*prev, new_piece)) {
+                const auto grown = makePiece<piece_type>(
+                    prev->start, prev->size + new_piece.size, true);
+                return replace_piece_range_with(prev, pos,
+                                                std::span{&grown, 1},
+                                                pos_offset - prev->size);
+            }
+        }
+        return replace_piece_range_with(pos, pos, std::span{&new_piece, 1},
+                                        pos_offset);
+    }
+
     // Splits given piece into two.
     // Doesn't modify the piece chain.
     // Returns the split pair
-    static SplitBlock split_piece_at(position_type pos) {
+    constexpr SplitBlock split_piece_at(position_type pos) const {
         assert(pos.in_piece_offset < pos.it->size);
+        stats_.count_split();
 
-        Piece left_split = {
-            .start = pos.it->start,
-            .size = pos.in_piece_offset,
-            .appended_sequence = pos.it->appended_sequence
-        };
+        const auto left_split = makePiece<piece_type>(
+            pos.it->start, pos.in_piece_offset, pos.it->appended_sequence);
 
-        Piece right_split = {
-            .start = pos.it->start + pos.in_piece_offset,
-            .size = pos.it->size - pos.in_piece_offset,
-            .appended_sequence = pos.it->appended_sequence
-        };
+        const auto right_split = makePiece<piece_type>(
+            pos.it->start + pos.in_piece_offset,
+            pos.it->size - pos.in_piece_offset, pos.it->appended_sequence);
 
         return {left_split, right_split};
     }
 
+    // Whether next directly follows piece in the append buffer, and can be
+    // merged into it
+    static constexpr bool continues(const piece_type& piece,
+                                    const piece_type& next) {
+        const size_type size = piece.size;
+        return piece.appended_sequence && next.appended_sequence
+               && piece.start + size == next.start
+               && size + next.size <= piece_type::max_size;
+    }
+
     OriginalBufferT original_buffer_;
     AppendBufferT append_buffer_;
     PieceSequenceT pieces_;
     size_type size_= 0;
+    PositionCache last_position_;
+    // counts in const member functions as well
+    [[no_unique_address]] mutable StatsT stats_;
+    // ascending offsets of the line breaks in the buffers, if line_indexed
+    std::vector<size_type> original_line_breaks_;
+    std::vector<size_type> append_line_breaks_;
 };
 
 #endif
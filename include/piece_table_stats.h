@@ -0,0 +1,108 @@
+#ifndef PIECE_TABLE_STATS_H
+#define PIECE_TABLE_STATS_H
+
+#include <atomic>
+#include <cstddef>
+
+// What the hot paths of a PieceTable did, see CountingLogger
+struct PieceTableCounters {
+    std::size_t lookups = 0;          // offset to piece lookups
+    std::size_t pieces_scanned = 0;   // stepped over by linear lookups
+    std::size_t splits = 0;           // cuts through pieces by edits
+    std::size_t splices = 0;          // piece ranges replaced, undo included
+    std::size_t spliced_pieces = 0;   // pieces taken out and put in by them
+    std::size_t appended = 0;         // elements added to the append buffer
+    std::size_t undo_pack_bytes = 0;  // pieces saved in UndoPacks, in bytes
+};
+
+// Stats policy of PieceTable (its last template parameter), counting
+// nothing - the calls compile away, and it takes no space in the table
+struct EmptyLogger {
+    constexpr void count_lookup(std::size_t) {}
+    constexpr void count_split() {}
+    constexpr void count_splice(std::size_t) {}
+    constexpr void count_append(std::size_t) {}
+    constexpr void count_undo_pack(std::size_t) {}
+
+    [[nodiscard]] constexpr PieceTableCounters counters() const { return {}; }
+    constexpr void reset() {}
+};
+
+// Stats policy filling PieceTableCounters. Reads are counted too, and
+// some run on several threads (e.g. find_all_parallel), so the counters
+// are atomic. Increments are relaxed, counters() read while the table is
+// in use may be a mix of before and after an operation.
+class CountingLogger {
+  public:
+    CountingLogger() = default;
+
+    CountingLogger(const CountingLogger& other) {
+        store(other.counters());
+    }
+    CountingLogger& operator=(const CountingLogger& other) {
+        store(other.counters());
+        return *this;
+    }
+
+    void count_lookup(std::size_t pieces_scanned) {
+        add(lookups_, 1);
+        add(pieces_scanned_, pieces_scanned);
+    }
+    void count_split() {
+        add(splits_, 1);
+    }
+    void count_splice(std::size_t pieces) {
+        add(splices_, 1);
+        add(spliced_pieces_, pieces);
+    }
+    void count_append(std::size_t elements) {
+        add(appended_, elements);
+    }
+    void count_undo_pack(std::size_t bytes) {
+        add(undo_pack_bytes_, bytes);
+    }
+
+    [[nodiscard]] PieceTableCounters counters() const {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        return {
+            .lookups = lookups_.load(relaxed),
+            .pieces_scanned = pieces_scanned_.load(relaxed),
+            .splits = splits_.load(relaxed),
+            .splices = splices_.load(relaxed),
+            .spliced_pieces = spliced_pieces_.load(relaxed),
+            .appended = appended_.load(relaxed),
+            .undo_pack_bytes = undo_pack_bytes_.load(relaxed),
+        };
+    }
+    void reset() {
+        store({});
+    }
+
+  private:
+    using counter = std::atomic<std::size_t>;
+
+    static void add(counter& c, std::size_t n) {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void store(const PieceTableCounters& counters) {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        lookups_.store(counters.lookups, relaxed);
+        pieces_scanned_.store(counters.pieces_scanned, relaxed);
+        splits_.store(counters.splits, relaxed);
+        splices_.store(counters.splices, relaxed);
+        spliced_pieces_.store(counters.spliced_pieces, relaxed);
+        appended_.store(counters.appended, relaxed);
+        undo_pack_bytes_.store(counters.undo_pack_bytes, relaxed);
+    }
+
+    counter lookups_ = 0;
+    counter pieces_scanned_ = 0;
+    counter splits_ = 0;
+    counter splices_ = 0;
+    counter spliced_pieces_ = 0;
+    counter appended_ = 0;
+    counter undo_pack_bytes_ = 0;
+};
+
+#endif  // PIECE_TABLE_STATS_H
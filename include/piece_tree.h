@@ -0,0 +1,573 @@
+#ifndef PIECE_TREE_H
+#define PIECE_TREE_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+#include "piece.h"
+
+// Piece sequence kept as a treap (a randomized balanced binary tree), ordered
+// by position in the document. Every node stores the total length and count
+// of the pieces in its subtree, so looking up the piece containing an offset
+// is O(log n) instead of a linear scan.
+//
+// Nodes are never moved or reallocated, so iterators behave like std::list
+// ones - they stay valid through insertions and splices (also between two
+// trees). This keeps UndoPack begin/end and the splice-based undo working.
+// Splicing a range is O(log n) split/merge, regardless of the range length.
+//
+// Nodes come from Allocator (rebound), which allows allocating them from an
+// arena or a pool, see pmr::PieceTree. Like for std::list, splicing requires
+// both trees to use equal allocators.
+//
+// Every node also carries the number of line breaks in its piece, summed up
+// the same way as the lengths. With IndexLines (LineIndexedPieceTree)
+// PieceTable keeps them up to date and answers line queries in O(log n).
+template <typename Allocator = std::allocator<Piece>, bool IndexLines = false>
+class BasicPieceTree {
+    struct Node {
+        Node* parent = nullptr;
+        Node* left = nullptr;
+        Node* right = nullptr;
+        Piece value{};
+        std::size_t line_breaks = 0;
+        std::size_t subtree_length = 0;
+        std::size_t subtree_count = 0;
+        std::size_t subtree_line_breaks = 0;
+        std::uint64_t priority = 0;
+    };
+
+    template <bool Const>
+    class Iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Piece;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const Piece*, Piece*>;
+        using reference = std::conditional_t<Const, const Piece&, Piece&>;
+
+        Iterator() = default;
+        template <bool OtherConst>
+            requires (Const && !OtherConst)
+        Iterator(const Iterator<OtherConst>& other) : node_{other.node_} {}
+
+        reference operator*() const { return node_->value; }
+        pointer operator->() const { return &node_->value; }
+
+        Iterator& operator++() {
+            node_ = next(node_);
+            return *this;
+        }
+        Iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        Iterator& operator--() {
+            node_ = prev(node_);
+            return *this;
+        }
+        Iterator operator--(int) {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+            return lhs.node_ == rhs.node_;
+        }
+
+      private:
+        friend class BasicPieceTree;
+        template <bool> friend class Iterator;
+        explicit Iterator(Node* node) : node_{node} {}
+
+        Node* node_ = nullptr;
+    };
+
+    using NodeAllocator =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAllocator>;
+
+  public:
+    using value_type = Piece;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = Piece&;
+    using const_reference = const Piece&;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    static constexpr bool indexes_lines = IndexLines;
+
+    BasicPieceTree() = default;
+
+    explicit BasicPieceTree(const Allocator& allocator)
+        : allocator_{allocator} {}
+
+    BasicPieceTree(std::initializer_list<Piece> pieces,
+                   const Allocator& allocator = Allocator{})
+        : allocator_{allocator} {
+        insert(end(), pieces.begin(), pieces.end());
+    }
+
+    BasicPieceTree(const BasicPieceTree& other)
+        : allocator_{NodeTraits::select_on_container_copy_construction(
+              other.allocator_)} {
+        set_root(clone(other.root()));
+    }
+
+    BasicPieceTree(BasicPieceTree&& other) noexcept
+        : allocator_{other.allocator_} {
+        set_root(other.root());
+        other.set_root(nullptr);
+    }
+
+    BasicPieceTree& operator=(const BasicPieceTree& other) {
+        if (this != &other) {
+            clear();
+            if constexpr (NodeTraits::propagate_on_container_copy_assignment
+                              ::value) {
+                allocator_ = other.allocator_;
+            }
+            set_root(clone(other.root()));
+        }
+        return *this;
+    }
+
+    BasicPieceTree& operator=(BasicPieceTree&& other) noexcept(
+            NodeTraits::propagate_on_container_move_assignment::value
+            || NodeTraits::is_always_equal::value) {
+        if (this != &other) {
+            clear();
+            if constexpr (NodeTraits::propagate_on_container_move_assignment
+                              ::value) {
+                allocator_ = other.allocator_;
+            }
+            if (allocator_ == other.allocator_) {
+                set_root(other.root());
+                other.set_root(nullptr);
+            }
+            else {
+                // the nodes can't change hands, copy them
+                set_root(clone(other.root()));
+                other.clear();
+            }
+        }
+        return *this;
+    }
+
+    ~BasicPieceTree() {
+        clear();
+    }
+
+    // Both trees must use equal allocators (unless they propagate on swap)
+    void swap(BasicPieceTree& other) noexcept {
+        if constexpr (NodeTraits::propagate_on_container_swap::value) {
+            std::swap(allocator_, other.allocator_);
+        }
+        assert(allocator_ == other.allocator_);
+        Node* other_root = other.root();
+        other.set_root(root());
+        set_root(other_root);
+    }
+
+    [[nodiscard]] allocator_type get_allocator() const {
+        return allocator_type{allocator_};
+    }
+
+    [[nodiscard]] iterator begin() { return iterator{leftmost()}; }
+    [[nodiscard]] iterator end() { return iterator{&header_}; }
+    [[nodiscard]] const_iterator begin() const {
+        return const_iterator{leftmost()};
+    }
+    [[nodiscard]] const_iterator end() const {
+        return const_iterator{const_cast<Node*>(&header_)};
+    }
+    [[nodiscard]] const_iterator cbegin() const { return begin(); }
+    [[nodiscard]] const_iterator cend() const { return end(); }
+
+    [[nodiscard]] bool empty() const { return root() == nullptr; }
+    [[nodiscard]] size_type size() const { return count_of(root()); }
+
+    // Sum of the sizes of all the pieces
+    [[nodiscard]] size_type total_length() const { return length_of(root()); }
+
+    // Returns the first piece with size > offset, after subtracting the sizes
+    // of all the pieces before it - same result as the linear scan.
+    [[nodiscard]] PieceTablePosition<iterator> find_offset(size_type offset) {
+        auto [in_piece_offset, it] = std::as_const(*this).find_offset(offset);
+        return {in_piece_offset, iterator{it.node_}};
+    }
+
+    [[nodiscard]] PieceTablePosition<const_iterator>
+    find_offset(size_type offset) const {
+        Node* node = root();
+        while (node != nullptr) {
+            if (offset < length_of(node->left)) {
+                node = node->left;
+                continue;
+            }
+            offset -= length_of(node->left);
+            if (offset < node->value.size) {
+                return {offset, const_iterator{node}};
+            }
+            offset -= node->value.size;
+            node = node->right;
+        }
+        return {offset, end()};
+    }
+
+    // Sum of the line breaks of all the pieces
+    [[nodiscard]] size_type total_line_breaks() const {
+        return line_breaks_of(root());
+    }
+
+    [[nodiscard]] size_type line_breaks(const_iterator pos) const {
+        return pos.node_->line_breaks;
+    }
+
+    // Sets the line break count of the piece, O(log n)
+    void set_line_breaks(const_iterator pos, size_type line_breaks) {
+        Node* node = pos.node_;
+        node->line_breaks = line_breaks;
+        for (; node != &header_; node = node->parent) {
+            update(node);
+        }
+    }
+
+    // Returns the piece containing the line break with the given (0-based)
+    // index, in_piece_offset being its index among the piece's line breaks
+    [[nodiscard]] PieceTablePosition<const_iterator>
+    find_line_break(size_type line_break) const {
+        Node* node = root();
+        while (node != nullptr) {
+            if (line_break < line_breaks_of(node->left)) {
+                node = node->left;
+                continue;
+            }
+            line_break -= line_breaks_of(node->left);
+            if (line_break < node->line_breaks) {
+                return {line_break, const_iterator{node}};
+            }
+            line_break -= node->line_breaks;
+            node = node->right;
+        }
+        return {line_break, end()};
+    }
+
+    // Number of line breaks in the pieces before pos, O(log n)
+    [[nodiscard]] size_type line_breaks_before(const_iterator pos) const {
+        const Node* node = pos.node_;
+        if (node == &header_) {
+            return total_line_breaks();
+        }
+        size_type line_breaks = line_breaks_of(node->left);
+        for (; node->parent != &header_; node = node->parent) {
+            if (node == node->parent->right) {
+                line_breaks += line_breaks_of(node->parent->left)
+                               + node->parent->line_breaks;
+            }
+        }
+        return line_breaks;
+    }
+
+    // Index of the piece in the sequence, O(log n)
+    [[nodiscard]] size_type index_of(const_iterator pos) const {
+        const Node* node = pos.node_;
+        if (node == &header_) {
+            return size();
+        }
+        size_type index = count_of(node->left);
+        for (; node->parent != &header_; node = node->parent) {
+            if (node == node->parent->right) {
+                index += count_of(node->parent->left) + 1;
+            }
+        }
+        return index;
+    }
+
+    // Document offset at which the piece starts, O(log n)
+    [[nodiscard]] size_type offset_of(const_iterator pos) const {
+        const Node* node = pos.node_;
+        if (node == &header_) {
+            return total_length();
+        }
+        size_type offset = length_of(node->left);
+        for (; node->parent != &header_; node = node->parent) {
+            if (node == node->parent->right) {
+                offset += length_of(node->parent->left)
+                          + node->parent->value.size;
+            }
+        }
+        return offset;
+    }
+
+    iterator insert(const_iterator pos, const Piece& piece) {
+        Node* node = create_node(piece);
+        insert_subtree(pos.node_, node);
+        return iterator{node};
+    }
+
+    template <typename InputIt>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        Node* subtree = nullptr;
+        Node* first_node = nullptr;
+        for (; first != last; ++first) {
+            Node* node = create_node(*first);
+            if (first_node == nullptr) {
+                first_node = node;
+            }
+            subtree = merge(subtree, node);
+        }
+        if (first_node == nullptr) {
+            return iterator{pos.node_};
+        }
+        insert_subtree(pos.node_, subtree);
+        return iterator{first_node};
+    }
+
+    void push_back(const Piece& piece) {
+        insert(end(), piece);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        destroy(extract(first.node_, last.node_));
+        return iterator{last.node_};
+    }
+
+    iterator erase(const_iterator pos) {
+        return erase(pos, std::next(pos));
+    }
+
+    void clear() {
+        destroy(root());
+        set_root(nullptr);
+    }
+
+    // Moves nodes [first, last) of other before pos. Iterators to the moved
+    // nodes stay valid and now refer to this tree.
+    void splice(const_iterator pos, BasicPieceTree& other,
+                const_iterator first, const_iterator last) {
+        assert(allocator_ == other.allocator_);
+        if (first == last) {
+            return;
+        }
+        insert_subtree(pos.node_, other.extract(first.node_, last.node_));
+    }
+
+    void splice(const_iterator pos, BasicPieceTree&& other,
+                const_iterator first, const_iterator last) {
+        splice(pos, other, first, last);
+    }
+
+    void splice(const_iterator pos, BasicPieceTree& other) {
+        assert(allocator_ == other.allocator_);
+        Node* subtree = other.root();
+        other.set_root(nullptr);
+        if (subtree != nullptr) {
+            insert_subtree(pos.node_, subtree);
+        }
+    }
+
+    void splice(const_iterator pos, BasicPieceTree&& other) {
+        splice(pos, other);
+    }
+
+  private:
+    // The header is the end() sentinel. The root hangs off its left pointer,
+    // so that in-order traversal naturally ends at / starts back from it.
+    Node* root() const { return header_.left; }
+
+    void set_root(Node* node) {
+        header_.left = node;
+        if (node != nullptr) {
+            node->parent = &header_;
+        }
+    }
+
+    Node* leftmost() const {
+        Node* node = const_cast<Node*>(&header_);
+        while (node->left != nullptr) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    static Node* next(Node* node) {
+        if (node->right != nullptr) {
+            node = node->right;
+            while (node->left != nullptr) {
+                node = node->left;
+            }
+            return node;
+        }
+        while (node == node->parent->right) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    static Node* prev(Node* node) {
+        if (node->left != nullptr) {
+            node = node->left;
+            while (node->right != nullptr) {
+                node = node->right;
+            }
+            return node;
+        }
+        while (node == node->parent->left) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    static size_type length_of(const Node* node) {
+        return node != nullptr ? node->subtree_length : 0;
+    }
+
+    static size_type count_of(const Node* node) {
+        return node != nullptr ? node->subtree_count : 0;
+    }
+
+    static size_type line_breaks_of(const Node* node) {
+        return node != nullptr ? node->subtree_line_breaks : 0;
+    }
+
+    static void update(Node* node) {
+        node->subtree_length = length_of(node->left) + node->value.size
+                               + length_of(node->right);
+        node->subtree_count = count_of(node->left) + 1 + count_of(node->right);
+        node->subtree_line_breaks = line_breaks_of(node->left)
+                                    + node->line_breaks
+                                    + line_breaks_of(node->right);
+        if (node->left != nullptr) {
+            node->left->parent = node;
+        }
+        if (node->right != nullptr) {
+            node->right->parent = node;
+        }
+    }
+
+    // Splits the subtree into the first count nodes and the rest.
+    // Parent pointers of the returned roots are not meaningful.
+    static std::pair<Node*, Node*> split(Node* node, size_type count) {
+        if (node == nullptr) {
+            return {nullptr, nullptr};
+        }
+        if (count <= count_of(node->left)) {
+            auto [left, right] = split(node->left, count);
+            node->left = right;
+            update(node);
+            return {left, node};
+        }
+        else {
+            auto [left, right] = split(node->right,
+                                       count - count_of(node->left) - 1);
+            node->right = left;
+            update(node);
+            return {node, right};
+        }
+    }
+
+    static Node* merge(Node* left, Node* right) {
+        if (left == nullptr) {
+            return right;
+        }
+        if (right == nullptr) {
+            return left;
+        }
+        if (left->priority > right->priority) {
+            left->right = merge(left->right, right);
+            update(left);
+            return left;
+        }
+        else {
+            right->left = merge(left, right->left);
+            update(right);
+            return right;
+        }
+    }
+
+    void insert_subtree(Node* pos, Node* subtree) {
+        auto [left, right] = split(root(), index_of(const_iterator{pos}));
+        set_root(merge(merge(left, subtree), right));
+    }
+
+    // Cuts [first, last) out of the tree and returns it as a detached subtree
+    Node* extract(Node* first, Node* last) {
+        const size_type first_index = index_of(const_iterator{first});
+        const size_type last_index = index_of(const_iterator{last});
+        assert(first_index <= last_index);
+
+        auto [left, rest] = split(root(), first_index);
+        auto [middle, right] = split(rest, last_index - first_index);
+        set_root(merge(left, right));
+        return middle;
+    }
+
+    static std::uint64_t make_priority(const Node* node) {
+        // splitmix64 of the node address - good enough randomness for a treap,
+        // and needs no shared state
+        auto x = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(node));
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    Node* create_node(const Piece& piece) {
+        Node* node = NodeTraits::allocate(allocator_, 1);
+        NodeTraits::construct(allocator_, node);
+        node->value = piece;
+        node->priority = make_priority(node);
+        update(node);
+        return node;
+    }
+
+    Node* clone(const Node* node) {
+        if (node == nullptr) {
+            return nullptr;
+        }
+        Node* copy = NodeTraits::allocate(allocator_, 1);
+        NodeTraits::construct(allocator_, copy);
+        copy->value = node->value;
+        copy->line_breaks = node->line_breaks;
+        copy->priority = node->priority;
+        copy->left = clone(node->left);
+        copy->right = clone(node->right);
+        update(copy);
+        return copy;
+    }
+
+    void destroy(Node* node) {
+        if (node == nullptr) {
+            return;
+        }
+        destroy(node->left);
+        destroy(node->right);
+        NodeTraits::destroy(allocator_, node);
+        NodeTraits::deallocate(allocator_, node, 1);
+    }
+
+    Node header_;
+    [[no_unique_address]] NodeAllocator allocator_;
+};
+
+using PieceTree = BasicPieceTree<>;
+using LineIndexedPieceTree = BasicPieceTree<std::allocator<Piece>, true>;
+
+namespace pmr {
+using PieceTree = BasicPieceTree<std::pmr::polymorphic_allocator<Piece>>;
+using LineIndexedPieceTree =
+    BasicPieceTree<std::pmr::polymorphic_allocator<Piece>, true>;
+}
+
+#endif  // PIECE_TREE_H
@@ -0,0 +1,135 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Scanning for a single value (e.g. '\n') or for substring candidates.
+// Single byte element types are compared a whole vector register at a time
+// (32 with AVX2, 16 with SSE2 or NEON), other types and targets without SIMD
+// fall back to a plain loop.
+namespace simd_scan {
+
+template <typename CharT>
+inline constexpr bool is_vectorizable = sizeof(CharT) == 1
+                                        && std::is_trivially_copyable_v<CharT>;
+
+namespace detail {
+
+// match_mask has bit i * mask_stride set if data[i] == value, and no other
+// bits set
+#if defined(__AVX2__)
+inline constexpr std::size_t block_size = 32;
+inline constexpr int mask_stride = 1;
+
+inline std::uint64_t match_mask(const void* data, char value) {
+    const __m256i block = _mm256_loadu_si256(
+        static_cast<const __m256i*>(data));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(block, _mm256_set1_epi8(value))));
+}
+#elif defined(__SSE2__)
+inline constexpr std::size_t block_size = 16;
+inline constexpr int mask_stride = 1;
+
+inline std::uint64_t match_mask(const void* data, char value) {
+    const __m128i block = _mm_loadu_si128(static_cast<const __m128i*>(data));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(block, _mm_set1_epi8(value))));
+}
+#elif defined(__ARM_NEON)
+inline constexpr std::size_t block_size = 16;
+inline constexpr int mask_stride = 4;
+
+// NEON has no movemask, narrowing the comparison result leaves a nibble
+// per element, the top bit of each one is kept
+inline std::uint64_t match_mask(const void* data, char value) {
+    const uint8x16_t equal = vceqq_u8(
+        vld1q_u8(static_cast<const std::uint8_t*>(data)),
+        vdupq_n_u8(static_cast<std::uint8_t>(value)));
+    const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0)
+           & 0x8888888888888888ull;
+}
+#else
+inline constexpr std::size_t block_size = 0;
+inline constexpr int mask_stride = 1;
+
+// never called, only keeps the vectorized paths compiling
+inline std::uint64_t match_mask(const void*, char) {
+    return 0;
+}
+#endif
+
+inline std::size_t lowest_match(std::uint64_t mask) {
+    return static_cast<std::size_t>(std::countr_zero(mask) / mask_stride);
+}
+
+}  // namespace detail
+
+// Calls f(i) for every i in [0, count) with data[i] == value, in order
+template <typename CharT, typename F>
+void for_each_equal(const CharT* data, std::size_t count, CharT value, F&& f) {
+    std::size_t i = 0;
+    if constexpr (is_vectorizable<CharT> && detail::block_size > 0) {
+        const auto byte = static_cast<char>(value);
+        for (; i + detail::block_size <= count; i += detail::block_size) {
+            for (std::uint64_t mask = detail::match_mask(data + i, byte);
+                    mask != 0; mask &= mask - 1) {
+                f(i + detail::lowest_match(mask));
+            }
+        }
+    }
+    for (; i < count; ++i) {
+        if (data[i] == value) {
+            f(i);
+        }
+    }
+}
+
+// Calls f(i) for every i in [0, count - last_offset) with data[i] == first
+// and data[i + last_offset] == last, in order, until f returns true.
+// Returns whether f did. Comparing both ends of a substring (last_offset
+// being its length - 1) filters out most of the candidates which only
+// share the first element.
+template <typename CharT, typename F>
+bool for_each_candidate(const CharT* data, std::size_t count,
+                        std::size_t last_offset, CharT first, CharT last,
+                        F&& f) {
+    const std::size_t end = count > last_offset ? count - last_offset : 0;
+    std::size_t i = 0;
+    if constexpr (is_vectorizable<CharT> && detail::block_size > 0) {
+        const auto first_byte = static_cast<char>(first);
+        const auto last_byte = static_cast<char>(last);
+        for (; i + detail::block_size <= end; i += detail::block_size) {
+            for (std::uint64_t mask
+                     = detail::match_mask(data + i, first_byte)
+                       & detail::match_mask(data + i + last_offset, last_byte);
+                    mask != 0; mask &= mask - 1) {
+                if (f(i + detail::lowest_match(mask))) {
+                    return true;
+                }
+            }
+        }
+    }
+    for (; i < end; ++i) {
+        if (data[i] == first && data[i + last_offset] == last && f(i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace simd_scan
+
+#endif  // SIMD_SCAN_H
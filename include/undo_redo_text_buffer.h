@@ -1,24 +1,120 @@
 #ifndef UNDO_REDO_TEXT_BUFFER_H
 #define UNDO_REDO_TEXT_BUFFER_H
 
+#include <cassert>
+#include <deque>
+#include <limits>
 #include <list>
-#include <vector>
+#include <memory>
+#include <optional>
 
 #include "piece_table.h"
 
 template <
     typename AppendBufferT,
     typename OriginalBufferT = std::basic_string<typename AppendBufferT::value_type>,
-    typename PieceSequenceT = std::list<Piece>>
+    typename PieceSequenceT = std::list<Piece>,
+    typename StatsT = EmptyLogger>
 class UndoRedoTextBuffer {
   public:
-    using value_type = CharT;
     using piece_table_t = PieceTable<OriginalBufferT,
                                      AppendBufferT,
-                                     PieceSequenceT>;
+                                     PieceSequenceT,
+                                     StatsT>;
+    using value_type = typename piece_table_t::value_type;
+    using size_type = typename piece_table_t::size_type;
+    using allocator_type = typename piece_table_t::allocator_type;
+    using piece_type = typename piece_table_t::piece_type;
+    using UndoPack = typename piece_table_t::UndoPack;
+    using Edit = typename piece_table_t::Edit;
+
+    // A PieceTable::Snapshot that also keeps the append buffer it points
+    // into alive, should compact() replace it
+    class Snapshot : public piece_table_t::Snapshot {
+      public:
+        Snapshot() = default;
+
+      private:
+        friend class UndoRedoTextBuffer;
+
+        Snapshot(typename piece_table_t::Snapshot snapshot,
+                 std::shared_ptr<const void> append_buffer)
+            : piece_table_t::Snapshot{std::move(snapshot)}
+            , append_buffer_{std::move(append_buffer)} {}
+
+        std::shared_ptr<const void> append_buffer_;
+    };
+
+    // Bounds of the undo history, the oldest operations are forgotten first.
+    // An operation is a single edit, a typing burst or a transaction.
+    // Bytes count the pieces and the appended text kept alive for undo only
+    // (e.g. deleted text, not text typed and still in the document).
+    struct HistoryLimit {
+        size_type max_operations = std::numeric_limits<size_type>::max();
+        size_type max_bytes = std::numeric_limits<size_type>::max();
+    };
+
+    // Forgotten history leaves unreferenced text in the append buffer, it's
+    // compacted once it grew twice as much (and at least this much) as
+    // the text kept at the previous compaction
+    static constexpr size_type min_compaction_size = 64 * 1024;
+
+    UndoRedoTextBuffer() = default;
+
+    // The allocator is used for the pieces and for the undo/redo stacks
+    explicit UndoRedoTextBuffer(const allocator_type& allocator)
+        : history_(allocator)
+        , groups_(allocator)
+        , piece_table_(allocator) {}
+
+    explicit UndoRedoTextBuffer(OriginalBufferT original_buffer)
+        : piece_table_(std::move(original_buffer)) {}
+
+    UndoRedoTextBuffer(OriginalBufferT original_buffer,
+                       const allocator_type& allocator)
+        : history_(allocator)
+        , groups_(allocator)
+        , piece_table_(std::move(original_buffer), allocator) {}
+
+    [[nodiscard]] HistoryLimit history_limit() const {
+        return history_limit_;
+    }
+
+    // Applies right away, or on commit inside a transaction
+    void set_history_limit(HistoryLimit history_limit) {
+        history_limit_ = history_limit;
+        // the open transaction can't be forgotten
+        if (transaction_depth_ == 0) {
+            trim_history();
+        }
+    }
+
+    [[nodiscard]] size_type undo_count() const { return undo_group_count_; }
+    [[nodiscard]] size_type redo_count() const {
+        return groups_.size() - undo_group_count_;
+    }
+
+    // Memory held by the undo history, as counted for HistoryLimit
+    [[nodiscard]] size_type history_bytes() const {
+        return history_bytes_;
+    }
+
+    // Drops the text no operation in the history can bring back. The
+    // replaced append buffer is freed with the last snapshot pointing into
+    // it.
+    void compact() {
+        AppendBufferT old_buffer
+            = piece_table_.compact_append_buffer(history_);
+        if (snapshot_buffer_ != nullptr) {
+            snapshot_buffer_->emplace(std::move(old_buffer));
+            snapshot_buffer_.reset();
+        }
+        compacted_size_ = piece_table_.append_buffer_size();
+        has_garbage_ = false;
+    }
 
     [[nodiscard]] bool is_empty() const {
-        return piece_table_.empty();
+        return piece_table_.is_empty();
     }
 
     [[nodiscard]] size_type length() const {
@@ -27,25 +123,113 @@ class UndoRedoTextBuffer {
     [[nodiscard]] size_type size() const {
         return piece_table_.size();
     }
+    [[nodiscard]] size_type piece_count() const {
+        return piece_table_.piece_count();
+    }
+
+    // See PieceTable::counters, undo and redo included
+    [[nodiscard]] PieceTableCounters counters() const {
+        return piece_table_.counters();
+    }
+    void reset_counters() {
+        piece_table_.reset_counters();
+    }
 
     [[nodiscard]] std::basic_string<value_type> to_string() const {
-        return piece_table_.to_string()
+        return piece_table_.to_string();
+    }
+
+    // See PieceTable::snapshot, taken by the writer. Valid through
+    // compactions, until the buffer is destroyed.
+    [[nodiscard]] Snapshot snapshot() const
+            requires StableStorage<AppendBufferT> {
+        if (snapshot_buffer_ == nullptr) {
+            snapshot_buffer_
+                = std::make_shared<std::optional<AppendBufferT>>();
+        }
+        return Snapshot{piece_table_.snapshot(), snapshot_buffer_};
+    }
+
+    void write_to(std::basic_ostream<value_type>& out) const {
+        piece_table_.write_to(out);
+    }
+
+#if __has_include(<sys/uio.h>)
+    void write_to(int fd) const {
+        piece_table_.write_to(fd);
+    }
+#endif
+
+    [[nodiscard]] size_type find(std::basic_string_view<value_type> pattern,
+                                 size_type from = 0) const {
+        return piece_table_.find(pattern, from);
+    }
+    [[nodiscard]] std::vector<size_type>
+    find_all(std::basic_string_view<value_type> pattern,
+             size_type from = 0) const {
+        return piece_table_.find_all(pattern, from);
+    }
+
+    [[nodiscard]] size_type line_count() const
+            requires piece_table_t::line_indexed {
+        return piece_table_.line_count();
+    }
+    [[nodiscard]] size_type line_to_offset(size_type line) const
+            requires piece_table_t::line_indexed {
+        return piece_table_.line_to_offset(line);
+    }
+    [[nodiscard]] size_type offset_to_line(size_type idx) const
+            requires piece_table_t::line_indexed {
+        return piece_table_.offset_to_line(idx);
+    }
+
+    // All the edits until the matching commit_transaction are undone and
+    // redone as a single operation (e.g. a replace-all). Can be nested.
+    void begin_transaction() {
+        assert(transaction_depth_ > 0 || transaction_size_ == 0);
+        break_typing_burst();
+        ++transaction_depth_;
+    }
+
+    void commit_transaction() {
+        assert(transaction_depth_ > 0);
+        if (--transaction_depth_ == 0) {
+            break_typing_burst();
+            transaction_size_ = 0;
+            trim_history();
+        }
+    }
+
+    // Consecutive inserts, each one right after the previous one, are merged
+    // into a single operation, until any other edit or a call to this
+    // (e.g. on a cursor move or a pause in typing)
+    void break_typing_burst() {
+        typing_end_ = no_typing_burst;
     }
 
     void clear() {
         new_operation(piece_table_.clear());
     }
 
+    void insert_at(size_type idx, value_type element) {
+        const bool continues_burst = idx == typing_end_;
+        new_operation(piece_table_.insert_at(idx, element), continues_burst);
+        typing_end_ = idx + 1;
+    }
+
     template<typename InputRange>
-    void insert_range_at(InputRange&& range) {
+    void insert_range_at(size_type idx, InputRange&& range) {
+        const bool continues_burst = idx == typing_end_;
+        const size_type size_before = size();
         new_operation(
-            piece_table_.insert_range_at(std::forward<InputRange>(range)));
+            piece_table_.insert_range_at(idx, std::forward<InputRange>(range)),
+            continues_burst);
+        typing_end_ = idx + (size() - size_before);
     }
 
     template<typename InputRange>
     void append_range(InputRange&& range) {
-        new_operation(
-            piece_table_.append_range(std::forward<InputRange>(range)));
+        insert_range_at(size(), std::forward<InputRange>(range));
     }
 
     void delete_range_at(size_type idx, size_type count) {
@@ -53,27 +237,136 @@ class UndoRedoTextBuffer {
             piece_table_.delete_range_at(idx, count));
     }
 
-    void undo() {
-        auto undo_pack = undo_stack_.back();
-        undo_stack_.pop_back();
-        redo_stack_.push_back(piece_table_.undo(std::move(undo_pack)));
+    // A batch of edits, e.g. one per cursor, as a single operation
+    void apply_edits(std::span<const Edit> edits) {
+        new_operation(piece_table_.apply_edits(edits));
+    }
 
+    // The packs of an operation are undone newest first, each one replaced
+    // in place by its redo pack, and redone oldest first. Packs are moved,
+    // never copied - a copied std::pmr sequence would get the default memory
+    // resource and couldn't be spliced back into pieces. Neither allocates
+    // with a splicable piece sequence or a std::vector with the capacity
+    // already.
+    void undo() {
+        assert(transaction_depth_ == 0 && undo_count() > 0);
+        break_typing_burst();
+        const Operation& operation = groups_[--undo_group_count_];
+        history_bytes_ -= operation.bytes;
+        for (size_type i = 0; i < operation.pack_count; ++i) {
+            UndoPack& pack = history_[--undo_pack_count_];
+            pack = piece_table_.undo(std::move(pack));
+        }
     }
     void redo() {
-        auto redo_pack = redo_stack_.back();
-        redo_stack_.pop_back();
-        undo_stack_.push_back(piece_table_.undo(std::move(redo_pack)));
+        assert(transaction_depth_ == 0 && redo_count() > 0);
+        break_typing_burst();
+        Operation& operation = groups_[undo_group_count_++];
+        operation.bytes = 0;
+        for (size_type i = 0; i < operation.pack_count; ++i) {
+            UndoPack& pack = history_[undo_pack_count_++];
+            pack = piece_table_.undo(std::move(pack));
+            operation.bytes += pack_bytes(pack);
+        }
+        history_bytes_ += operation.bytes;
+        trim_history();
     }
 
   private:
-    void new_operation(UndoPack p) {
-        redo_stack_.clear();
-        undo_stack_.push_back(std::move(p));
+    using UndoPackAllocator = typename std::allocator_traits<allocator_type>
+        ::template rebind_alloc<UndoPack>;
+    // An entry of groups_. The bytes of its packs are counted when they're
+    // applied, the pieces replacing them can't be looked at later.
+    struct Operation {
+        size_type pack_count;
+        size_type bytes;
+    };
+
+    using OperationAllocator = typename std::allocator_traits<allocator_type>
+        ::template rebind_alloc<Operation>;
+
+    static constexpr size_type no_typing_burst
+        = std::numeric_limits<size_type>::max();
+
+    // Pushes the pack of an edit, as a new operation, or as a part of
+    // the current transaction or typing burst
+    void new_operation(UndoPack p, bool continues_burst = false) {
+        has_garbage_ = has_garbage_ || redo_count() > 0;
+        history_.erase(std::next(history_.begin(), undo_pack_count_),
+                       history_.end());
+        groups_.erase(std::next(groups_.begin(), undo_group_count_),
+                      groups_.end());
+        const size_type bytes = pack_bytes(p);
+        history_bytes_ += bytes;
+        history_.push_back(std::move(p));
+        ++undo_pack_count_;
+
+        if ((transaction_depth_ > 0 && transaction_size_ > 0)
+                || (transaction_depth_ == 0 && continues_burst
+                    && !groups_.empty())) {
+            ++groups_.back().pack_count;
+            groups_.back().bytes += bytes;
+        }
+        else {
+            groups_.push_back({1, bytes});
+            ++undo_group_count_;
+        }
+        transaction_size_ += transaction_depth_ > 0;
+        typing_end_ = no_typing_burst;
+
+        // the open transaction can't be forgotten, it's bounded on commit
+        if (transaction_depth_ == 0) {
+            trim_history();
+        }
+
+        if (has_garbage_ && piece_table_.append_buffer_size()
+                >= 2 * compacted_size_ + min_compaction_size) {
+            compact();
+        }
+    }
+
+    void trim_history() {
+        while (undo_group_count_ > 0
+                && (undo_group_count_ > history_limit_.max_operations
+                    || history_bytes_ > history_limit_.max_bytes)) {
+            for (size_type i = 0; i < groups_.front().pack_count; ++i) {
+                history_.pop_front();
+            }
+            history_bytes_ -= groups_.front().bytes;
+            undo_pack_count_ -= groups_.front().pack_count;
+            groups_.pop_front();
+            --undo_group_count_;
+            has_garbage_ = true;
+        }
+    }
+
+    // Of the pack just applied
+    size_type pack_bytes(const UndoPack& pack) const {
+        return std::size(pack.data) * sizeof(piece_type)
+               + piece_table_.undo_only_size(pack) * sizeof(value_type);
     }
 
-    std::vector<typename piece_table_t::UndoPack> undo_stack_;
-    std::vector<typename piece_table_t::UndoPack> redo_stack_;
+    // The undo packs, oldest first, followed by the redo packs, next to be
+    // redone first. Undo and redo only move the boundary between the two.
+    //
+    //   history_:  [ undo | undo | undo | redo | redo ]
+    //                                   ^undo_pack_count_
+    std::deque<UndoPack, UndoPackAllocator> history_;
+    // the operations the packs make up, the same way
+    std::deque<Operation, OperationAllocator> groups_;
+    size_type undo_pack_count_ = 0;
+    size_type undo_group_count_ = 0;
     piece_table_t piece_table_;
+    HistoryLimit history_limit_;
+    size_type history_bytes_ = 0;
+    size_type compacted_size_ = 0;
+    bool has_garbage_ = false;
+    // shared with the snapshots taken since the last compaction, which
+    // moves the replaced append buffer in
+    mutable std::shared_ptr<std::optional<AppendBufferT>> snapshot_buffer_;
+    size_type transaction_depth_ = 0;
+    size_type transaction_size_ = 0;  // packs in the open transaction
+    size_type typing_end_ = no_typing_burst;
 };
 
 #endif  // UNDO_REDO_TEXT_BUFFER_H
@@ -0,0 +1,232 @@
+// Benchmarks of the piece table operations across the piece sequences and
+// original buffers, to choose a backend and catch regressions.
+// Needs Google Benchmark:
+//
+//   g++ -std=c++20 -O2 -DNDEBUG benchmark.cpp -lbenchmark -lpthread
+//   ./a.out --benchmark_filter=ToString
+//
+// Tables under test are built with a given number of pieces (the argument)
+// over a 4 MiB original document.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../include/mapped_file_buffer.h"
+#include "../include/piece_btree.h"
+#include "../include/piece_table.h"
+#include "../include/piece_tree.h"
+#include "../include/undo_redo_text_buffer.h"
+
+namespace {
+
+constexpr std::size_t original_size = std::size_t{4} << 20;
+constexpr std::string_view inserted_text = "lorem ipsum ";
+
+// Written once in main, the original of the MappedFileBuffer tables
+std::filesystem::path mapped_path;
+
+std::string originalText() {
+    std::string text(original_size, ' ');
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        text[i] = i % 64 == 63 ? '\n' : static_cast<char>('a' + i % 26);
+    }
+    return text;
+}
+
+template <typename OriginalBufferT>
+OriginalBufferT makeOriginal() {
+    if constexpr (std::is_same_v<OriginalBufferT, MappedFileBuffer<char>>) {
+        return MappedFileBuffer<char>{mapped_path.string()};
+    }
+    else {
+        return OriginalBufferT(originalText());
+    }
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+using Table = PieceTable<OriginalBufferT, std::string, PieceSequenceT>;
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+using TextBuffer = UndoRedoTextBuffer<std::string, OriginalBufferT,
+                                      PieceSequenceT>;
+
+// Evenly spread inserts, front to back so that the linear sequences find
+// each one next to the previous one - about two pieces per insert
+template <typename TableT>
+void fragment(TableT& table, std::size_t piece_count) {
+    const std::size_t insert_count = piece_count / 2;
+    if (insert_count == 0) {
+        return;
+    }
+    const std::size_t stride = table.size() / insert_count;
+    for (std::size_t i = 0; i < insert_count; ++i) {
+        table.insert_range_at(i * (stride + inserted_text.size()) + stride / 2,
+                              inserted_text);
+    }
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+Table<OriginalBufferT, PieceSequenceT> makeTable(std::size_t piece_count) {
+    Table<OriginalBufferT, PieceSequenceT> table{
+        makeOriginal<OriginalBufferT>()};
+    fragment(table, piece_count);
+    return table;
+}
+
+// Every edit is undone right away, so the piece count stays the argument
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_RandomInsert(benchmark::State& state) {
+    auto table = makeTable<OriginalBufferT, PieceSequenceT>(state.range(0));
+    std::mt19937_64 rng{1};
+    for (auto _ : state) {
+        const std::size_t idx = rng() % (table.size() + 1);
+        table.undo(table.insert_range_at(idx, inserted_text));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_RandomDelete(benchmark::State& state) {
+    auto table = makeTable<OriginalBufferT, PieceSequenceT>(state.range(0));
+    std::mt19937_64 rng{2};
+    for (auto _ : state) {
+        const std::size_t count = rng() % 256;
+        const std::size_t idx = rng() % (table.size() - count);
+        table.undo(table.delete_range_at(idx, count));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// A keystroke per iteration, with a jump elsewhere every 64 of them
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_Typing(benchmark::State& state) {
+    TextBuffer<OriginalBufferT, PieceSequenceT> buffer{
+        makeOriginal<OriginalBufferT>()};
+    buffer.set_history_limit({.max_operations = 1000});
+    std::mt19937_64 rng{3};
+    std::size_t cursor = buffer.size() / 2;
+    std::size_t typed = 0;
+    for (auto _ : state) {
+        if (++typed % 64 == 0) {
+            buffer.break_typing_burst();
+            cursor = rng() % (buffer.size() + 1);
+        }
+        buffer.insert_at(cursor++, 'x');
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Undoes, then redoes, the 1000 operations of a history of inserts and
+// deletes of up to the argument elements
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_UndoRedo(benchmark::State& state) {
+    TextBuffer<OriginalBufferT, PieceSequenceT> buffer{
+        makeOriginal<OriginalBufferT>()};
+    const std::string text(state.range(0), 'y');
+    std::mt19937_64 rng{4};
+    for (int i = 0; i < 1000; ++i) {
+        const std::size_t count = 1 + rng() % state.range(0);
+        if (i % 2 == 0) {
+            buffer.insert_range_at(rng() % (buffer.size() + 1),
+                                   std::string_view{text}.substr(0, count));
+        }
+        else {
+            buffer.delete_range_at(rng() % (buffer.size() - count), count);
+        }
+    }
+    for (auto _ : state) {
+        while (buffer.undo_count() > 0) {
+            buffer.undo();
+        }
+        while (buffer.redo_count() > 0) {
+            buffer.redo();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2000);
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_ToString(benchmark::State& state) {
+    const auto table = makeTable<OriginalBufferT, PieceSequenceT>(
+        state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.to_string());
+    }
+    state.SetBytesProcessed(state.iterations() * table.size());
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_At(benchmark::State& state) {
+    const auto table = makeTable<OriginalBufferT, PieceSequenceT>(
+        state.range(0));
+    std::mt19937_64 rng{5};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.at(rng() % table.size()));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename OriginalBufferT, typename PieceSequenceT>
+void BM_Substr(benchmark::State& state) {
+    const auto table = makeTable<OriginalBufferT, PieceSequenceT>(
+        state.range(0));
+    std::mt19937_64 rng{6};
+    for (auto _ : state) {
+        const std::size_t idx = rng() % (table.size() - 4096);
+        benchmark::DoNotOptimize(table.substr(idx, 4096));
+    }
+    state.SetBytesProcessed(state.iterations() * 4096);
+}
+
+using String = std::string;
+using Mapped = MappedFileBuffer<char>;
+
+#define PIECE_TABLE_BENCHMARK(name, original, ...)                        \
+    BENCHMARK_TEMPLATE(name, original, std::list<Piece>) __VA_ARGS__;     \
+    BENCHMARK_TEMPLATE(name, original, std::vector<Piece>) __VA_ARGS__;   \
+    BENCHMARK_TEMPLATE(name, original, PieceTree) __VA_ARGS__;            \
+    BENCHMARK_TEMPLATE(name, original, PieceBTree) __VA_ARGS__
+
+#define PIECE_COUNTS ->RangeMultiplier(8)->Range(8, 1 << 15)
+
+PIECE_TABLE_BENCHMARK(BM_RandomInsert, String, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_RandomInsert, Mapped, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_RandomDelete, String, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_RandomDelete, Mapped, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_Typing, String);
+PIECE_TABLE_BENCHMARK(BM_Typing, Mapped);
+PIECE_TABLE_BENCHMARK(BM_UndoRedo, String, ->Arg(16)->Arg(1 << 16));
+PIECE_TABLE_BENCHMARK(BM_ToString, String, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_ToString, Mapped, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_At, String, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_At, Mapped, PIECE_COUNTS);
+PIECE_TABLE_BENCHMARK(BM_Substr, String, PIECE_COUNTS);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    mapped_path = std::filesystem::temp_directory_path()
+                  / "piece_table_benchmark.txt";
+    {
+        std::ofstream out{mapped_path, std::ios::binary};
+        const std::string text = originalText();
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::filesystem::remove(mapped_path);
+}
@@ -1,10 +1,12 @@
 #include <iostream>
 #include <list>
+#include <vector>
 
 #include "../include/piece_table.h"
 
-int main() {
-    PieceTable<std::string, std::string, std::list<Piece>> pt {
+template <typename PieceSequenceT>
+void demo() {
+    PieceTable<std::string, std::string, PieceSequenceT> pt {
         "Original text buffer"
     };
 
@@ -37,3 +39,10 @@ int main() {
     pt.undo(std::move(undo_pack1));
     std::cout << pt.to_string() << std::endl;
 }
+
+int main() {
+    // splicable sequence, UndoPacks hold iterators
+    demo<std::list<Piece>>();
+    // random access sequence, UndoPacks hold indices
+    demo<std::vector<Piece>>();
+}
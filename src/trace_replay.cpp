@@ -0,0 +1,457 @@
+// Replays a recorded editing trace through PieceTable and UndoRedoTextBuffer
+// and reports how each piece sequence copes with it, e.g. with the
+// automerge-paper trace of https://github.com/josephg/editing-traces:
+//
+//   g++ -std=c++20 -O2 -DNDEBUG trace_replay.cpp -o trace_replay
+//   gunzip automerge-paper.json.gz
+//   ./trace_replay automerge-paper.json [list] [vector] [tree] [btree]
+//
+// A trace is JSON, either
+//   {"startContent": "...", "endContent": "...",
+//    "txns": [{"patches": [[position, delete_count, "text"], ...]}, ...]}
+// or just the array of patches. Positions count Unicode code points, so
+// the document is replayed as UTF-32. The result is checked against
+// endContent, if the trace has it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../include/piece_btree.h"
+#include "../include/piece_table.h"
+#include "../include/piece_tree.h"
+#include "../include/undo_redo_text_buffer.h"
+
+// Heap usage, to report the peak of each replay. Every block carries its
+// size in front of it.
+namespace {
+
+std::atomic<std::size_t> heap_in_use = 0;
+std::atomic<std::size_t> heap_peak = 0;
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    auto* block = static_cast<std::max_align_t*>(
+        std::malloc(size + sizeof(std::max_align_t)));
+    if (block == nullptr) {
+        throw std::bad_alloc{};
+    }
+    *reinterpret_cast<std::size_t*>(block) = size;
+    const std::size_t in_use = heap_in_use += size;
+    std::size_t peak = heap_peak.load(std::memory_order_relaxed);
+    while (in_use > peak && !heap_peak.compare_exchange_weak(peak, in_use)) {
+    }
+    return block + 1;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto* block = static_cast<std::max_align_t*>(ptr) - 1;
+    heap_in_use -= *reinterpret_cast<std::size_t*>(block);
+    std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+struct Patch {
+    std::size_t position;
+    std::size_t delete_count;
+    std::u32string text;
+};
+
+struct Trace {
+    std::u32string start_content;
+    std::u32string end_content;
+    bool has_end_content = false;
+    std::vector<Patch> patches;
+};
+
+// Just enough JSON for traces, skipping the members it doesn't know
+class TraceParser {
+  public:
+    explicit TraceParser(std::string_view json) : json_{json} {}
+
+    Trace parse() {
+        Trace trace;
+        skip_space();
+        if (peek() == '[') {
+            parse_patches(trace.patches);
+        }
+        else {
+            parse_object([&](std::string_view key) {
+                if (key == "startContent") {
+                    trace.start_content = parse_string();
+                }
+                else if (key == "endContent") {
+                    trace.end_content = parse_string();
+                    trace.has_end_content = true;
+                }
+                else if (key == "txns") {
+                    parse_array([&] {
+                        parse_object([&](std::string_view txn_key) {
+                            if (txn_key == "patches") {
+                                parse_patches(trace.patches);
+                            }
+                            else {
+                                skip_value();
+                            }
+                        });
+                    });
+                }
+                else {
+                    skip_value();
+                }
+            });
+        }
+        return trace;
+    }
+
+  private:
+    void parse_patches(std::vector<Patch>& patches) {
+        parse_array([&] {
+            Patch patch;
+            expect('[');
+            patch.position = parse_number();
+            expect(',');
+            patch.delete_count = parse_number();
+            expect(',');
+            patch.text = parse_string();
+            expect(']');
+            patches.push_back(std::move(patch));
+        });
+    }
+
+    template <typename F>
+    void parse_array(F&& element) {
+        expect('[');
+        if (try_consume(']')) {
+            return;
+        }
+        do {
+            element();
+        } while (try_consume(','));
+        expect(']');
+    }
+
+    template <typename F>
+    void parse_object(F&& member) {
+        expect('{');
+        if (try_consume('}')) {
+            return;
+        }
+        do {
+            skip_space();
+            const std::string key = to_utf8_key(parse_string());
+            expect(':');
+            member(std::string_view{key});
+        } while (try_consume(','));
+        expect('}');
+    }
+
+    void skip_value() {
+        skip_space();
+        switch (peek()) {
+        case '"':
+            parse_string();
+            break;
+        case '[':
+            parse_array([&] { skip_value(); });
+            break;
+        case '{':
+            parse_object([&](std::string_view) { skip_value(); });
+            break;
+        default:
+            while (pos_ < json_.size()
+                    && std::string_view{",]} \t\r\n"}.find(json_[pos_])
+                       == std::string_view::npos) {
+                ++pos_;
+            }
+        }
+    }
+
+    std::size_t parse_number() {
+        skip_space();
+        std::size_t value = 0;
+        const std::size_t begin = pos_;
+        while (pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9') {
+            value = value * 10 + static_cast<std::size_t>(json_[pos_++] - '0');
+        }
+        if (pos_ == begin) {
+            fail("expected a non-negative integer");
+        }
+        return value;
+    }
+
+    std::u32string parse_string() {
+        expect('"');
+        std::u32string text;
+        while (true) {
+            if (pos_ >= json_.size()) {
+                fail("unterminated string");
+            }
+            const auto c = static_cast<unsigned char>(json_[pos_]);
+            if (c == '"') {
+                ++pos_;
+                return text;
+            }
+            if (c == '\\') {
+                ++pos_;
+                text.push_back(parse_escape());
+            }
+            else {
+                text.push_back(decode_utf8());
+            }
+        }
+    }
+
+    char32_t parse_escape() {
+        if (pos_ >= json_.size()) {
+            fail("unterminated escape");
+        }
+        switch (json_[pos_++]) {
+        case '"': return U'"';
+        case '\\': return U'\\';
+        case '/': return U'/';
+        case 'b': return U'\b';
+        case 'f': return U'\f';
+        case 'n': return U'\n';
+        case 'r': return U'\r';
+        case 't': return U'\t';
+        case 'u': {
+            char32_t code = parse_hex4();
+            // a surrogate pair encodes a code point past the BMP
+            if (code >= 0xd800 && code < 0xdc00
+                    && json_.substr(pos_, 2) == "\\u") {
+                pos_ += 2;
+                const char32_t low = parse_hex4();
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+            return code;
+        }
+        default:
+            fail("bad escape");
+        }
+    }
+
+    char32_t parse_hex4() {
+        if (pos_ + 4 > json_.size()) {
+            fail("truncated \\u escape");
+        }
+        const std::string digits{json_.substr(pos_, 4)};
+        pos_ += 4;
+        return static_cast<char32_t>(std::stoul(digits, nullptr, 16));
+    }
+
+    char32_t decode_utf8() {
+        const auto lead = static_cast<unsigned char>(json_[pos_++]);
+        const int extra = lead < 0x80 ? 0 : lead < 0xe0 ? 1 : lead < 0xf0 ? 2 : 3;
+        char32_t code = extra == 0 ? lead : lead & (0x3f >> extra);
+        for (int i = 0; i < extra && pos_ < json_.size(); ++i) {
+            code = (code << 6) | (static_cast<unsigned char>(json_[pos_++]) & 0x3f);
+        }
+        return code;
+    }
+
+    // Keys are ASCII
+    static std::string to_utf8_key(const std::u32string& key) {
+        return std::string(key.begin(), key.end());
+    }
+
+    void expect(char c) {
+        if (!try_consume(c)) {
+            fail(std::string{"expected '"} + c + "'");
+        }
+    }
+
+    bool try_consume(char c) {
+        skip_space();
+        if (peek() == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    void skip_space() {
+        while (pos_ < json_.size()
+                && (json_[pos_] == ' ' || json_[pos_] == '\n'
+                    || json_[pos_] == '\r' || json_[pos_] == '\t')) {
+            ++pos_;
+        }
+    }
+
+    char peek() const {
+        return pos_ < json_.size() ? json_[pos_] : '\0';
+    }
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error("trace: " + what + " at byte "
+                                 + std::to_string(pos_));
+    }
+
+    std::string_view json_;
+    std::size_t pos_ = 0;
+};
+
+Trace loadTrace(const char* path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        throw std::runtime_error(std::string{"trace: can't open "} + path);
+    }
+    std::ostringstream json;
+    json << in.rdbuf();
+    return TraceParser{json.str()}.parse();
+}
+
+struct ReplayResult {
+    double seconds = 0;
+    std::vector<std::uint64_t> latencies;  // ns, per patch
+    std::size_t piece_count = 0;
+    std::size_t peak_heap = 0;  // bytes, over what was used before
+    bool matches = true;
+};
+
+std::uint64_t percentile(std::vector<std::uint64_t>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    const auto nth = values.begin()
+        + static_cast<std::ptrdiff_t>(p * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+// Applies the patches one by one, timing each of them
+template <typename TextT>
+ReplayResult replay(const Trace& trace) {
+    using Clock = std::chrono::steady_clock;
+
+    ReplayResult result;
+    result.latencies.reserve(trace.patches.size());
+    const std::size_t heap_before = heap_in_use;
+    heap_peak = heap_before;
+
+    const auto start = Clock::now();
+    {
+        TextT text{std::u32string{trace.start_content}};
+        for (const Patch& patch : trace.patches) {
+            const auto before = Clock::now();
+            if (patch.delete_count > 0) {
+                text.delete_range_at(patch.position, patch.delete_count);
+            }
+            if (!patch.text.empty()) {
+                text.insert_range_at(patch.position,
+                                     std::u32string_view{patch.text});
+            }
+            result.latencies.push_back(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - before).count()));
+        }
+        result.seconds = std::chrono::duration<double>(
+            Clock::now() - start).count();
+        result.piece_count = text.piece_count();
+        result.peak_heap = heap_peak - heap_before;
+        if (trace.has_end_content) {
+            result.matches = text.to_string() == trace.end_content;
+        }
+    }
+    return result;
+}
+
+bool report(const char* backend, const char* target, ReplayResult result) {
+    const auto ops = static_cast<double>(result.latencies.size());
+    std::printf("%-8s %-20s %12.0f %9llu %9llu %10zu %12.1f%s\n",
+                backend, target,
+                result.seconds > 0 ? ops / result.seconds : 0.0,
+                static_cast<unsigned long long>(
+                    percentile(result.latencies, 0.5)),
+                static_cast<unsigned long long>(
+                    percentile(result.latencies, 0.99)),
+                result.piece_count,
+                static_cast<double>(result.peak_heap) / (1 << 20),
+                result.matches ? "" : "  MISMATCH");
+    return result.matches;
+}
+
+template <typename PieceSequenceT>
+bool run(const char* backend, const Trace& trace) {
+    using Table = PieceTable<std::u32string, std::u32string, PieceSequenceT>;
+    using Buffer = UndoRedoTextBuffer<std::u32string, std::u32string,
+                                      PieceSequenceT>;
+    const bool table_matches = report(backend, "PieceTable",
+                                      replay<Table>(trace));
+    const bool buffer_matches = report(backend, "UndoRedoTextBuffer",
+                                       replay<Buffer>(trace));
+    return table_matches && buffer_matches;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s trace.json [list] [vector] [tree] "
+                             "[btree]\n", argv[0]);
+        return 2;
+    }
+
+    Trace trace;
+    try {
+        trace = loadTrace(argv[1]);
+    }
+    catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+
+    std::vector<std::string_view> backends(argv + 2, argv + argc);
+    if (backends.empty()) {
+        backends = {"list", "vector", "tree", "btree"};
+    }
+
+    std::printf("%zu patches, %zu -> %zu code points\n\n",
+                trace.patches.size(), trace.start_content.size(),
+                trace.end_content.size());
+    std::printf("%-8s %-20s %12s %9s %9s %10s %12s\n", "backend", "target",
+                "ops/s", "p50 ns", "p99 ns", "pieces", "peak MiB");
+
+    bool matches = true;
+    for (std::string_view backend : backends) {
+        if (backend == "list") {
+            matches &= run<std::list<Piece>>("list", trace);
+        }
+        else if (backend == "vector") {
+            matches &= run<std::vector<Piece>>("vector", trace);
+        }
+        else if (backend == "tree") {
+            matches &= run<PieceTree>("tree", trace);
+        }
+        else if (backend == "btree") {
+            matches &= run<PieceBTree>("btree", trace);
+        }
+        else {
+            std::fprintf(stderr, "unknown backend %.*s\n",
+                         static_cast<int>(backend.size()), backend.data());
+            return 2;
+        }
+    }
+    return matches ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// Checks that the hot paths don't allocate where they needn't, counted by
+// a replaced global operator new, assert-based:
+//
+//   g++ -std=c++20 -O1 -g allocation_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../include/piece_tree.h"
+#include "../include/undo_redo_text_buffer.h"
+
+namespace {
+
+std::size_t allocations = 0;
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+template <typename F>
+std::size_t count_allocations(F f) {
+    const std::size_t before = allocations;
+    f();
+    return allocations - before;
+}
+
+// The history's byte accounting of an insert or a delete doesn't allocate,
+// and undo and redo don't at all
+template <typename PieceSequenceT>
+void edits_undo_redo() {
+    using Buffer = UndoRedoTextBuffer<std::string, std::string,
+                                      PieceSequenceT>;
+    using Table = typename Buffer::piece_table_t;
+
+    Table table{std::string(1000, 'o')};
+    table.append_range(std::string_view{"appended"});
+    const auto insert = table.insert_range_at(1003, std::string_view{"in"});
+    assert(count_allocations([&] { (void)table.undo_only_size(insert); })
+           == 0);
+    const auto deletion = table.delete_range_at(998, 8);
+    std::size_t undo_only = 0;
+    assert(count_allocations([&] {
+               undo_only = table.undo_only_size(deletion);
+           }) == 0);
+    assert(undo_only == 6);
+
+    Buffer buffer{std::string(1000, 'o')};
+    buffer.append_range(std::string_view{"appended"});
+    buffer.insert_range_at(500, std::string_view{"inserted"});
+    buffer.delete_range_at(100, 600);
+    // a std::vector undo pack gets the capacity it's swapped into on the
+    // first round
+    buffer.undo();
+    buffer.undo();
+    buffer.redo();
+    buffer.redo();
+    for (int i = 0; i < 2; ++i) {
+        assert(count_allocations([&] { buffer.undo(); }) == 0);
+        assert(count_allocations([&] { buffer.undo(); }) == 0);
+        assert(count_allocations([&] { buffer.redo(); }) == 0);
+        assert(count_allocations([&] { buffer.redo(); }) == 0);
+    }
+}
+
+}  // namespace
+
+int main() {
+    edits_undo_redo<std::list<Piece>>();
+    edits_undo_redo<PieceTree>();
+    edits_undo_redo<std::vector<Piece>>();
+    std::puts("allocation_test: OK");
+}
@@ -0,0 +1,129 @@
+// Checks of the parts of PieceTable used from several threads, assert-based,
+// meant to be run under ThreadSanitizer (and AddressSanitizer):
+//
+//   g++ -std=c++20 -O1 -g -fsanitize=thread concurrency_test.cpp -pthread
+//   ./a.out
+
+#undef NDEBUG
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/chunked_append_buffer.h"
+#include "../include/piece_btree.h"
+#include "../include/piece_table.h"
+#include "../include/piece_tree.h"
+#include "../include/undo_redo_text_buffer.h"
+
+namespace {
+
+// A document over the parallel threshold, cut into many pieces
+template <typename PieceTableT>
+PieceTableT make_document() {
+    std::string original;
+    while (original.size() < (std::size_t{2} << 20)) {
+        original += "the quick brown fox jumps over the lazy dog\n";
+    }
+    PieceTableT table{std::move(original)};
+    for (std::size_t i = 0; i < 1000; ++i) {
+        const std::size_t offset = i * 1999 % table.size();
+        table.insert_range_at(offset, std::string_view{"fox"});
+        table.delete_range_at(offset / 2, 5);
+    }
+    return table;
+}
+
+// Matches crossing the ranges of the threads and the pieces are found once
+template <typename PieceSequenceT>
+void find_all_parallel_matches_find_all() {
+    const auto table = make_document<
+        PieceTable<std::string, std::string, PieceSequenceT>>();
+    for (const std::string_view pattern : {"fox", "o", "dog\nthe", "foxfox"}) {
+        const auto expected = table.find_all(pattern);
+        assert(!expected.empty());
+        for (const unsigned thread_count : {2u, 3u, 8u, 64u}) {
+            assert(table.find_all_parallel(pattern, thread_count)
+                   == expected);
+        }
+        assert(table.find_all_parallel(pattern, 8, 12345)
+               == table.find_all(pattern, 12345));
+    }
+}
+
+// The counters are written by the search threads as well
+void counting_logger_find_all_parallel() {
+    using Table = PieceTable<std::string, std::string, std::list<Piece>,
+                             CountingLogger>;
+    const Table table = make_document<Table>();
+    const std::size_t lookups_before = table.counters().lookups;
+
+    const auto found = table.find_all_parallel("fox", 8);
+    assert(!found.empty());
+    assert(table.counters().lookups > lookups_before);
+}
+
+// Readers of snapshots, taken by a writer that keeps editing (and
+// compacting) meanwhile, see the document as it was when they were taken
+void snapshots_read_while_writing() {
+    using Buffer = UndoRedoTextBuffer<ChunkedAppendBuffer<char>>;
+    struct Published {
+        Buffer::Snapshot snapshot;
+        std::string text;
+    };
+
+    Buffer buffer{std::string(1000, 'o')};
+    buffer.set_history_limit({.max_operations = 10});
+    std::mutex mutex;  // guards the pointer only
+    auto published = std::make_shared<const Published>(
+        Published{buffer.snapshot(), buffer.to_string()});
+    std::atomic<bool> done = false;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                std::shared_ptr<const Published> latest;
+                {
+                    std::lock_guard lock{mutex};
+                    latest = published;
+                }
+                std::string text(latest->snapshot.size(), '\0');
+                latest->snapshot.copy_range(0, text.size(), text);
+                assert(text == latest->text);
+            }
+        });
+    }
+
+    for (std::size_t i = 0; i < 2000; ++i) {
+        const std::size_t offset = i * 7 % buffer.size();
+        buffer.insert_range_at(offset, std::string(100, 'a' + i % 26));
+        buffer.delete_range_at(offset / 2, 100);
+        auto next = std::make_shared<const Published>(
+            Published{buffer.snapshot(), buffer.to_string()});
+        std::lock_guard lock{mutex};
+        published = std::move(next);
+    }
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+}
+
+}  // namespace
+
+int main() {
+    find_all_parallel_matches_find_all<std::list<Piece>>();
+    find_all_parallel_matches_find_all<std::vector<Piece>>();
+    find_all_parallel_matches_find_all<PieceTree>();
+    find_all_parallel_matches_find_all<PieceBTree>();
+    counting_logger_find_all_parallel();
+    snapshots_read_while_writing();
+    std::puts("concurrency_test: OK");
+}
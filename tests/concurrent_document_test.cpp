@@ -0,0 +1,204 @@
+// Checks of ConcurrentDocument, assert-based, meant to be run under
+// ThreadSanitizer:
+//
+//   g++ -std=c++20 -O1 -g -fsanitize=thread -pthread
+//       concurrent_document_test.cpp
+//   ./a.out
+
+#undef NDEBUG
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/concurrent_document.h"
+
+namespace {
+
+using Document = ConcurrentDocument<>;
+using Command = Document::Command;
+
+std::string text_of(const Document& document) {
+    const auto reader = document.read();
+    std::string text(reader->size(), '\0');
+    reader->copy_range(0, text.size(), text);
+    return text;
+}
+
+Command edit(std::size_t offset, std::size_t delete_count, std::string text,
+             Document::group_type group) {
+    return {Command::Kind::edit, offset, delete_count, std::move(text),
+            group};
+}
+
+Command undo(Document::group_type group) {
+    return {Command::Kind::undo, 0, 0, {}, group};
+}
+
+// Two clients editing independently, each undoing only their own edits.
+// The result, undos included, is the same however the commands are split
+// into drains.
+void undo_steps_follow_groups_not_drains() {
+    constexpr Document::group_type alice = 1;
+    constexpr Document::group_type bob = 2;
+    const std::vector<Command> commands = {
+        edit(0, 0, "Hi,", alice),
+        edit(7, 0, "!", bob),
+        undo(alice),                    // not alice's latest operation
+        edit(3, 0, " there", alice),    // after bob's, a step of its own
+        undo(alice),
+        undo(bob),
+        undo(alice),
+    };
+
+    for (std::size_t drain_every = 1; drain_every <= commands.size();
+            ++drain_every) {
+        EpochDomain domain;
+        Document document{domain, std::string{" you"}};
+        for (std::size_t i = 0; i < commands.size(); ++i) {
+            document.submit(commands[i]);
+            if ((i + 1) % drain_every == 0 || i + 1 == commands.size()) {
+                document.drain();
+            }
+        }
+        assert(text_of(document) == " you");
+        assert(document.rejected_count() == 1);
+
+        // the first undo got rejected, bob's edit is still there before
+        // the other undos
+        Document partial{domain, std::string{" you"}};
+        for (std::size_t i = 0; i < 4; ++i) {
+            partial.submit(commands[i]);
+            if ((i + 1) % drain_every == 0) {
+                partial.drain();
+            }
+        }
+        partial.drain();
+        assert(text_of(partial) == "Hi, there you!");
+    }
+}
+
+// Edits without a group are undone one by one
+void ungrouped_edits_are_steps_of_their_own() {
+    EpochDomain domain;
+    Document document{domain, std::string{"abc"}};
+    document.insert_at(3, "d");
+    document.insert_at(4, "e");
+    document.delete_range_at(0, 1);
+    document.drain();
+    assert(text_of(document) == "bcde");
+
+    document.undo();
+    document.drain();
+    assert(text_of(document) == "abcde");
+    document.undo();
+    document.drain();
+    assert(text_of(document) == "abcd");
+    document.redo(7);  // the next redo isn't of group 7
+    document.drain();
+    assert(text_of(document) == "abcd");
+    assert(document.rejected_count() == 1);
+}
+
+// A group used for a whole session is still undone drain by drain, within
+// the history limit
+void long_lived_group_under_history_limit() {
+    constexpr Document::group_type client = 42;
+    EpochDomain domain;
+    Document document{domain, std::string{}, {.max_operations = 3}};
+    for (std::size_t i = 0; i < 100; ++i) {
+        document.insert_at(i, "x", client);
+        document.drain();
+    }
+    assert(document.undo_count() == 3);
+
+    // two edits in a drain are one step
+    document.insert_at(100, "y", client);
+    document.insert_at(101, "y", client);
+    document.drain();
+    assert(document.undo_count() == 3);
+
+    document.undo(client);
+    document.drain();
+    assert(text_of(document) == std::string(100, 'x'));
+    document.undo(client);
+    document.drain();
+    assert(text_of(document) == std::string(99, 'x'));
+    document.undo(client);
+    document.undo(client);
+    document.drain();
+    assert(text_of(document) == std::string(98, 'x'));
+    assert(document.undo_count() == 0);
+    assert(document.redo_count() == 3);
+    assert(document.rejected_count() == 1);
+}
+
+// Blocks of 3 equal elements, as inserted by concurrent_writers_and_readers
+bool whole_blocks(const std::string& text) {
+    if (text.size() % 3 != 0) {
+        return false;
+    }
+    for (std::size_t i = 0; i < text.size(); i += 3) {
+        if (text[i] < 'a' || text[i] >= 'a' + 4 || text[i + 1] != text[i]
+                || text[i + 2] != text[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writers on several threads, each its own group, readers meanwhile.
+// Whatever gets undone, whole inserts are.
+void concurrent_writers_and_readers() {
+    EpochDomain domain;
+    Document document{domain, std::string{}, {.max_operations = 50}};
+    std::atomic<bool> done = false;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 2; ++i) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                assert(whole_blocks(text_of(document)));
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; ++w) {
+        writers.emplace_back([&document, w] {
+            const char c = static_cast<char>('a' + w);
+            const auto group = static_cast<Document::group_type>(w + 1);
+            for (int i = 0; i < 2000; ++i) {
+                if (i % 10 == 9) {
+                    document.undo(group);
+                }
+                else {
+                    document.insert_at(0, std::string(3, c), group);
+                }
+                document.drain();
+            }
+        });
+    }
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    document.drain();
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    assert(whole_blocks(text_of(document)));
+}
+
+}  // namespace
+
+int main() {
+    undo_steps_follow_groups_not_drains();
+    ungrouped_edits_are_steps_of_their_own();
+    long_lived_group_under_history_limit();
+    concurrent_writers_and_readers();
+    std::puts("concurrent_document_test: OK");
+}
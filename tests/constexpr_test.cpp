@@ -0,0 +1,73 @@
+// Checks that PieceTable stays usable in constant expressions: the tests
+// are static_asserts, it's checked by compiling it
+//
+//   g++ -std=c++20 -fsyntax-only constexpr_test.cpp
+
+#include <array>
+#include <string_view>
+#include <vector>
+
+#include "../include/piece_table.h"
+
+namespace {
+
+using Table = PieceTable<std::string_view, std::vector<char>,
+                         std::vector<Piece>>;
+
+constexpr bool equals(const Table& table, std::string_view expected) {
+    if (table.size() != expected.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        if (table.at(i) != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr bool insert_delete_undo_redo() {
+    Table table{std::string_view{"hello world"}};
+    auto insert = table.insert_range_at(5, std::string_view{","});
+    auto append = table.append_range(std::string_view{"!"});
+    auto deletion = table.delete_range_at(0, 1);
+    bool ok = equals(table, "ello, world!");
+
+    auto redo = table.undo(std::move(deletion));
+    ok = ok && equals(table, "hello, world!");
+    deletion = table.undo(std::move(redo));
+    ok = ok && equals(table, "ello, world!");
+
+    table.undo(std::move(deletion));
+    table.undo(std::move(append));
+    table.undo(std::move(insert));
+    return ok && equals(table, "hello world") && table.piece_count() == 1;
+}
+static_assert(insert_delete_undo_redo());
+
+constexpr bool apply_edits_and_undo() {
+    Table table{std::string_view{"one two three"}};
+    const std::array<Table::Edit, 3> edits = {{
+        {0, 3, "1"},
+        {4, 3, "2"},
+        {13, 0, "!"},
+    }};
+    auto pack = table.apply_edits(edits);
+    const bool edited = equals(table, "1 2 three!");
+    table.undo(std::move(pack));
+    return edited && equals(table, "one two three");
+}
+static_assert(apply_edits_and_undo());
+
+constexpr bool coalesced_typing() {
+    Table table{std::string_view{"ab"}};
+    table.insert_at(1, 'x');
+    table.insert_at(2, 'y');
+    table.insert_at(3, 'z');
+    return equals(table, "axyzb") && table.piece_count() == 3;
+}
+static_assert(coalesced_typing());
+
+}  // namespace
+
+int main() {}
@@ -0,0 +1,118 @@
+// Checks of the edit journal's crash recovery, assert-based:
+//
+//   g++ -std=c++20 -O1 -g edit_journal_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/edit_journal.h"
+#include "../include/undo_redo_text_buffer.h"
+
+namespace {
+
+using Buffer = UndoRedoTextBuffer<std::string>;
+
+const std::string original = "hello world";
+
+// A session of every kind of record, and the document it leaves
+std::string write_session(std::ostream& out) {
+    EditJournalWriter<char> journal{out};
+    Buffer buffer{original};
+    const auto both = [&](auto operation) {
+        operation(buffer);
+        operation(journal);
+    };
+
+    both([](auto& b) { b.insert_range_at(5, std::string_view{","}); });
+    both([](auto& b) { b.delete_range_at(0, 1); });
+    both([](auto& b) { b.insert_at(0, 'H'); });
+    both([](auto& b) { b.begin_transaction(); });
+    const std::vector<Buffer::Edit> edits = {{0, 1, "J"}, {7, 5, "there"}};
+    both([&](auto& b) { b.apply_edits(edits); });
+    both([](auto& b) { b.commit_transaction(); });
+    both([](auto& b) { b.undo(); });
+    both([](auto& b) { b.redo(); });
+    both([](auto& b) { b.undo(); });
+    return buffer.to_string();
+}
+
+void replay_restores_session() {
+    std::stringstream journal;
+    const std::string expected = write_session(journal);
+
+    Buffer buffer{original};
+    const EditJournalReplay replay
+        = replayEditJournal<char>(journal, buffer);
+    assert(replay.complete);
+    assert(replay.records == 9);
+    assert(replay.valid_bytes == journal.str().size());
+    assert(buffer.to_string() == expected);
+    buffer.redo();
+    assert(buffer.to_string() == "Jello, there");
+}
+
+// Garbage after the journal ends replay as a torn record, and so does any
+// cut of it, whatever follows
+void torn_or_garbage_tail_ends_replay() {
+    std::stringstream session;
+    write_session(session);
+    const std::string journal = session.str();
+
+    struct Tail {
+        std::string bytes;
+        std::size_t valid_bytes;  // of it, after the whole journal
+    };
+    const std::vector<Tail> tails = {
+        {"", 0},
+        // lengths of a few exabytes
+        {{"\x01\x00\xff\xff\xff\xff\xff\xff\xff\xff\x01", 11}, 0},
+        {{"\x03\xff\xff\xff\xff\xff\xff\xff\xff\x01", 10}, 0},
+        {{"\x03\x01\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff\x01",
+          13}, 0},
+        {{"\x02\x05\xff\x01", 4}, 0},    // deletes past the end
+        {{"\x01\xff\x01\x00", 4}, 0},    // inserts past the end
+        {{"\x08", 1}, 0},                // commit, nothing open
+        {{"\x06\x06", 2}, 1},            // a redo more than undone
+        {{"\x07\x05", 2}, 1},            // undo in a transaction
+        {{"\x03\x02\x05\x00\x00\x01\x00\x00", 8}, 0},  // unsorted
+        {{"\x7f", 1}, 0},                // unknown tag
+    };
+    for (const Tail& tail : tails) {
+        std::stringstream in{journal + tail.bytes};
+        Buffer buffer{original};
+        const EditJournalReplay replay = replayEditJournal<char>(in, buffer);
+        assert(replay.valid_bytes == journal.size() + tail.valid_bytes);
+        assert(replay.complete == tail.bytes.empty());
+    }
+
+    for (std::size_t cut = 5; cut <= journal.size(); ++cut) {
+        for (const Tail& tail : tails) {
+            std::stringstream in{journal.substr(0, cut) + tail.bytes};
+            Buffer buffer{original};
+            const EditJournalReplay replay
+                = replayEditJournal<char>(in, buffer);
+            assert(replay.complete == (replay.valid_bytes == in.str().size()));
+            assert(buffer.undo_count() <= replay.records);
+
+            // the valid part replays the same way on its own
+            std::stringstream valid{in.str().substr(0, replay.valid_bytes)};
+            Buffer again{original};
+            assert(replayEditJournal<char>(valid, again).records
+                   == replay.records);
+            assert(again.to_string() == buffer.to_string());
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    replay_restores_session();
+    torn_or_garbage_tail_ends_replay();
+    std::puts("edit_journal_test: OK");
+}
@@ -0,0 +1,108 @@
+// Checks of LazyFileBuffer reading a temporary file, on access and in the
+// background, assert-based:
+//
+//   g++ -std=c++20 -O1 -g -pthread lazy_file_buffer_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../include/lazy_file_buffer.h"
+#include "../include/piece_table.h"
+
+namespace {
+
+using Buffer = LazyFileBuffer<char>;
+
+class TempFile {
+  public:
+    explicit TempFile(std::string_view contents) {
+        const int fd = ::mkstemp(path_);
+        assert(fd >= 0);
+        assert(::write(fd, contents.data(), contents.size())
+               == static_cast<ssize_t>(contents.size()));
+        ::close(fd);
+    }
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+    ~TempFile() { ::unlink(path_); }
+
+    std::string path() const { return path_; }
+
+  private:
+    char path_[32] = "/tmp/lazy_file_buffer_XXXXXX";
+};
+
+// Every region, whole and from the middle, in an order other than the
+// loader's, and the document of a PieceTable opened on the buffer
+void reads_regions(Buffer::Load load) {
+    std::string contents;
+    for (int i = 0; contents.size() < 10000; ++i) {
+        contents += "line " + std::to_string(i) + '\n';
+    }
+    const TempFile file{contents};
+    constexpr std::size_t region_size = 64;
+
+    const Buffer buffer{file.path(), load, region_size};
+    assert(buffer.size() == contents.size());
+    assert(buffer.region_count()
+           == (contents.size() + region_size - 1) / region_size);
+    for (std::size_t region = buffer.region_count(); region-- > 0;) {
+        const std::size_t first = region * region_size;
+        const std::size_t count = std::min(region_size,
+                                           contents.size() - first);
+        assert(std::string_view(buffer.data_at(first), count)
+               == std::string_view(contents).substr(first, count));
+        assert(buffer.is_loaded(region));
+        const std::size_t middle = first + count / 2;
+        assert(std::string_view(buffer.data_at(middle), first + count - middle)
+               == std::string_view(contents).substr(middle,
+                                                    first + count - middle));
+    }
+    assert(buffer.data_at(contents.size()) == nullptr);
+
+    using Table = PieceTable<Buffer, std::string, std::vector<Piece>>;
+    Table table{Buffer{file.path(), load, 100}};
+    assert(table.to_string() == contents);
+    table.insert_range_at(150, std::string_view{"inserted"});
+    assert(table.to_string()
+           == std::string{contents}.insert(150, "inserted"));
+}
+
+// A directory opens and has a size, but reading it fails: the error gets
+// to the reader whether it's the loader or the access that reads first
+void read_errors_reach_the_reader(Buffer::Load load) {
+    const Buffer buffer{"/tmp", load, 1};
+    if (buffer.empty()) {
+        return;
+    }
+    for (int i = 0; i < 2; ++i) {
+        try {
+            (void)buffer.data_at(0);
+            assert(false);
+        }
+        catch (const std::system_error& error) {
+            assert(error.code().value() == EISDIR);
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    reads_regions(Buffer::Load::on_access);
+    reads_regions(Buffer::Load::background);
+    read_errors_reach_the_reader(Buffer::Load::on_access);
+    read_errors_reach_the_reader(Buffer::Load::background);
+    std::puts("lazy_file_buffer_test: OK");
+}
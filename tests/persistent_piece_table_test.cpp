@@ -0,0 +1,154 @@
+// Differential test of PersistentPieceTable against a model keeping every
+// version as a std::string, assert-based:
+//
+//   g++ -std=c++20 -O1 -g persistent_piece_table_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/persistent_piece_table.h"
+
+namespace {
+
+using Table = PersistentPieceTable<std::string, std::string>;
+using version_id = Table::version_id;
+
+// The version tree, the way the table keeps it
+struct Model {
+    struct Version {
+        std::string text;
+        version_id parent;
+        version_id last_child;
+    };
+
+    explicit Model(std::string original)
+        : versions{{std::move(original), Table::no_version,
+                    Table::no_version}} {}
+
+    const std::string& text() const { return versions[current].text; }
+
+    void commit(std::string text) {
+        versions[current].last_child = versions.size();
+        versions.push_back({std::move(text), current, Table::no_version});
+        current = versions.size() - 1;
+    }
+
+    std::vector<Version> versions;
+    version_id current = 0;
+};
+
+void check(const Table& table, const Model& model, std::mt19937& random) {
+    assert(table.to_string() == model.text());
+    assert(table.current_version() == model.current);
+    assert(table.version_count() == model.versions.size());
+    assert(table.can_undo()
+           == (model.versions[model.current].parent != Table::no_version));
+    assert(table.can_redo()
+           == (model.versions[model.current].last_child
+               != Table::no_version));
+    if (!model.text().empty()) {
+        const std::size_t idx = random() % model.text().size();
+        const std::size_t count = random() % (model.text().size() - idx + 1);
+        assert(table.at(idx) == model.text()[idx]);
+        assert(table.substr(idx, count) == model.text().substr(idx, count));
+    }
+}
+
+void random_session(unsigned seed) {
+    std::mt19937 random{seed};
+    const std::string original = "The quick brown fox\njumps over the dog";
+    Table table{original};
+    Model model{original};
+    const auto snapshot_of_original = table.snapshot();
+
+    for (int step = 0; step < 2000; ++step) {
+        const std::string& text = model.text();
+        const std::size_t size = text.size();
+        switch (random() % 8) {
+        case 0:
+        case 1: {
+            const std::size_t idx = random() % (size + 1);
+            const std::string inserted(1 + random() % 5,
+                                       static_cast<char>('a' + step % 26));
+            table.insert_range_at(idx, inserted);
+            model.commit(std::string{text}.insert(idx, inserted));
+            break;
+        }
+        case 2: {
+            // typing right after the previous insert grows its piece
+            const std::size_t idx = random() % (size + 1);
+            table.insert_at(idx, 'x');
+            model.commit(std::string{text}.insert(idx, 1, 'x'));
+            table.insert_at(idx + 1, 'y');
+            model.commit(std::string{model.text()}.insert(idx + 1, 1, 'y'));
+            break;
+        }
+        case 3: {
+            if (size == 0) {
+                break;
+            }
+            const std::size_t idx = random() % size;
+            const std::size_t count = 1 + random() % (size - idx);
+            table.delete_range_at(idx, count);
+            model.commit(std::string{text}.erase(idx, count));
+            break;
+        }
+        case 4:
+            if (table.can_undo()) {
+                table.undo();
+                model.current = model.versions[model.current].parent;
+            }
+            break;
+        case 5:
+            if (table.can_redo()) {
+                table.redo();
+                model.current = model.versions[model.current].last_child;
+            }
+            break;
+        case 6: {
+            // checkout makes the branch it lands on the one redo follows
+            const version_id version = random() % model.versions.size();
+            table.checkout(version);
+            for (version_id child = version;
+                    model.versions[child].parent != Table::no_version;
+                    child = model.versions[child].parent) {
+                model.versions[model.versions[child].parent].last_child
+                    = child;
+            }
+            model.current = version;
+            break;
+        }
+        case 7: {
+            const version_id version = random() % model.versions.size();
+            const auto snapshot = table.snapshot(version);
+            assert(snapshot.to_string() == model.versions[version].text);
+            assert(snapshot.size() == model.versions[version].text.size());
+            break;
+        }
+        }
+        check(table, model, random);
+    }
+
+    assert(snapshot_of_original.to_string() == original);
+    for (version_id version = 0; version < model.versions.size();
+            ++version) {
+        assert(table.snapshot(version).to_string()
+               == model.versions[version].text);
+        assert(table.parent_version(version)
+               == model.versions[version].parent);
+    }
+}
+
+}  // namespace
+
+int main() {
+    for (unsigned seed = 1; seed <= 20; ++seed) {
+        random_session(seed);
+    }
+    std::puts("persistent_piece_table_test: OK");
+}
@@ -0,0 +1,98 @@
+// Checks that the piece sequences behave the same, assert-based: the
+// random-access ones (UndoPacks holding indices) against std::list
+// (UndoPacks holding iterators).
+//
+//   g++ -std=c++20 -O1 -g piece_sequence_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "../include/piece_table.h"
+
+namespace {
+
+// The states of the document along a scripted session, and piece counts
+struct Trace {
+    std::vector<std::string> texts;
+    std::vector<std::size_t> piece_counts;
+
+    bool operator==(const Trace&) const = default;
+};
+
+template <typename PieceSequenceT>
+Trace edit_undo_redo() {
+    using Table = PieceTable<std::string, std::string, PieceSequenceT>;
+    using UndoPack = typename Table::UndoPack;
+
+    Table pt{"Original text buffer"};
+    Trace trace;
+    const auto record = [&] {
+        trace.texts.push_back(pt.to_string());
+        trace.piece_counts.push_back(pt.piece_count());
+    };
+
+    std::vector<UndoPack> undo_packs;
+    undo_packs.push_back(pt.delete_range_at(9, 5));
+    undo_packs.push_back(pt.append_range(std::string_view{" is cool"}));
+    undo_packs.push_back(
+        pt.insert_range_at(pt.size() - 4, std::string_view{"pretty "}));
+    undo_packs.push_back(pt.insert_at(pt.size() - 1, '-'));
+    undo_packs.push_back(pt.delete_range_at(0, 15));
+    undo_packs.push_back(
+        pt.insert_range_at(0, std::string_view{"Piece table"}));
+    undo_packs.push_back(pt.delete_at(pt.size() - 2));
+    undo_packs.push_back(pt.append('!'));
+    record();
+
+    // all the way back, then forth, then back again
+    std::vector<UndoPack> redo_packs;
+    while (!undo_packs.empty()) {
+        redo_packs.push_back(pt.undo(std::move(undo_packs.back())));
+        undo_packs.pop_back();
+        record();
+    }
+    while (!redo_packs.empty()) {
+        undo_packs.push_back(pt.undo(std::move(redo_packs.back())));
+        redo_packs.pop_back();
+        record();
+    }
+    while (!undo_packs.empty()) {
+        redo_packs.push_back(pt.undo(std::move(undo_packs.back())));
+        undo_packs.pop_back();
+    }
+    record();
+    return trace;
+}
+
+void random_access_sequences_match_list() {
+    const Trace expected = edit_undo_redo<std::list<Piece>>();
+    assert(expected.texts.front() == "Piece table is pretty cool!");
+    assert(expected.texts.back() == "Original text buffer");
+
+    // undo and redo restore the pieces, not only the text
+    const std::size_t edit_count = (expected.texts.size() - 2) / 2;
+    for (std::size_t i = 0; i <= edit_count; ++i) {
+        const std::size_t undone = i;
+        const std::size_t redone = 2 * edit_count - i;
+        assert(expected.texts[undone] == expected.texts[redone]);
+        assert(expected.piece_counts[undone]
+               == expected.piece_counts[redone]);
+    }
+    assert(expected.piece_counts.back() == expected.piece_counts[edit_count]);
+
+    assert(edit_undo_redo<std::vector<Piece>>() == expected);
+    assert(edit_undo_redo<std::deque<Piece>>() == expected);
+}
+
+}  // namespace
+
+int main() {
+    random_access_sequences_match_list();
+    std::puts("piece_sequence_test: OK");
+}
@@ -0,0 +1,413 @@
+// Randomized checks of PieceTable against a std::string model, over the
+// piece sequences, assert-based:
+//
+//   g++ -std=c++20 -O1 -g piece_table_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if __has_include(<sys/uio.h>)
+#include <unistd.h>
+#endif
+
+#include "../include/piece_btree.h"
+#include "../include/piece_table.h"
+#include "../include/piece_tree.h"
+
+namespace {
+
+// A batch of sorted, non-overlapping edits of a document of the given size,
+// inserts at the same offset included
+template <typename Edit>
+std::vector<Edit> random_edits(std::size_t size,
+                               std::vector<std::string>& texts,
+                               std::mt19937& random) {
+    std::vector<Edit> edits;
+    texts.clear();
+    texts.reserve(8);
+    std::size_t offset = 0;
+    const std::size_t count = 1 + random() % 8;
+    for (std::size_t i = 0; i < count && offset <= size; ++i) {
+        offset += random() % (size - offset + 1) / 2;
+        const std::size_t delete_count
+            = random() % 3 == 0 ? 0 : random() % ((size - offset) / 4 + 1);
+        texts.emplace_back(random() % 4, static_cast<char>('A' + i));
+        edits.push_back({offset, delete_count, texts.back()});
+        offset += delete_count;
+    }
+    return edits;
+}
+
+// apply_edits gives the same document as the same edits applied one at
+// a time, undoing the batch restores the document and its pieces, redoing
+// it the edited document
+template <typename PieceSequenceT>
+void apply_edits_as_sequential(unsigned seed) {
+    using Table = PieceTable<std::string, std::string, PieceSequenceT>;
+    using Edit = typename Table::Edit;
+
+    std::mt19937 random{seed};
+    Table batched{"The quick brown fox\njumps over the lazy dog"};
+    Table sequential{"The quick brown fox\njumps over the lazy dog"};
+    std::string model = batched.to_string();
+    std::vector<std::string> texts;
+
+    for (int round = 0; round < 300; ++round) {
+        // a few single edits in between, for more pieces to sweep over
+        const std::size_t idx = random() % (model.size() + 1);
+        const std::string inserted(1 + random() % 3, 'a' + round % 26);
+        batched.insert_range_at(idx, std::string_view{inserted});
+        sequential.insert_range_at(idx, std::string_view{inserted});
+        model.insert(idx, inserted);
+        if (round % 3 == 0 && !model.empty()) {
+            const std::size_t at = random() % model.size();
+            const std::size_t count = 1 + random() % std::min<std::size_t>(
+                                              model.size() - at, 4);
+            batched.delete_range_at(at, count);
+            sequential.delete_range_at(at, count);
+            model.erase(at, count);
+        }
+
+        const auto edits = random_edits<Edit>(model.size(), texts, random);
+        const std::string before = model;
+        const std::size_t pieces_before = batched.piece_count();
+
+        // the model applies them ascending, shifted by the earlier ones
+        std::ptrdiff_t shift = 0;
+        for (const Edit& edit : edits) {
+            const auto offset = static_cast<std::size_t>(
+                static_cast<std::ptrdiff_t>(edit.offset) + shift);
+            model.replace(offset, edit.delete_count,
+                          edit.text.data(), edit.text.size());
+            shift += static_cast<std::ptrdiff_t>(edit.text.size())
+                     - static_cast<std::ptrdiff_t>(edit.delete_count);
+        }
+        // the twin table descending, so the offsets stay valid
+        for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+            sequential.delete_range_at(edit->offset, edit->delete_count);
+            sequential.insert_range_at(edit->offset, edit->text);
+        }
+
+        auto pack = batched.apply_edits(edits);
+        assert(batched.to_string() == model);
+        assert(sequential.to_string() == model);
+        assert(batched.size() == model.size());
+
+        if (round % 4 == 0) {
+            auto redo = batched.undo(std::move(pack));
+            assert(batched.to_string() == before);
+            assert(batched.piece_count() == pieces_before);
+            pack = batched.undo(std::move(redo));
+            assert(batched.to_string() == model);
+        }
+        if (round % 5 == 0) {
+            // keep going from the document before the batch
+            batched.undo(std::move(pack));
+            assert(batched.to_string() == before);
+            assert(batched.piece_count() == pieces_before);
+            sequential = Table{before};
+            model = before;
+        }
+    }
+}
+
+// Line queries of a model: a line break belongs to the line it ends
+std::size_t line_breaks_before(const std::string& text, std::size_t idx) {
+    return static_cast<std::size_t>(
+        std::count(text.begin(), text.begin() + idx, '\n'));
+}
+
+template <typename Table>
+void check_lines(const Table& table, const std::string& model) {
+    assert(table.to_string() == model);
+    assert(table.line_count() == line_breaks_before(model, model.size()) + 1);
+    std::size_t line = 0;
+    assert(table.line_to_offset(0) == 0);
+    for (std::size_t idx = 0; idx <= model.size(); ++idx) {
+        assert(table.offset_to_line(idx) == line);
+        if (idx < model.size() && model[idx] == '\n') {
+            ++line;
+            assert(table.line_to_offset(line) == idx + 1);
+        }
+    }
+}
+
+// Line queries agree with the model after inserts and deletes of text with
+// line breaks, across them, and after undo and redo of those
+void line_queries_as_model(unsigned seed) {
+    using Table = PieceTable<std::string, std::string, LineIndexedPieceTree>;
+    using UndoPack = Table::UndoPack;
+
+    std::mt19937 random{seed};
+    Table table{"first\nsecond\n\nfourth"};
+    std::vector<std::string> undo_texts;
+    std::vector<std::string> redo_texts;
+    std::vector<UndoPack> undo_packs;
+    std::vector<UndoPack> redo_packs;
+    std::string model = table.to_string();
+    check_lines(table, model);
+
+    static constexpr std::string_view pieces[] = {
+        "\n", "ab", "\n\n", "c\nd", "line\n", "\nline",
+    };
+    for (int step = 0; step < 400; ++step) {
+        switch (random() % 5) {
+        case 0:
+        case 1: {
+            const std::size_t idx = random() % (model.size() + 1);
+            const std::string_view inserted = pieces[random() % 6];
+            undo_texts.push_back(model);
+            undo_packs.push_back(table.insert_range_at(idx, inserted));
+            model.insert(idx, inserted);
+            redo_packs.clear();
+            redo_texts.clear();
+            break;
+        }
+        case 2: {
+            if (model.empty()) {
+                break;
+            }
+            const std::size_t idx = random() % model.size();
+            const std::size_t count = 1 + random() % std::min<std::size_t>(
+                                              model.size() - idx, 8);
+            undo_texts.push_back(model);
+            undo_packs.push_back(table.delete_range_at(idx, count));
+            model.erase(idx, count);
+            redo_packs.clear();
+            redo_texts.clear();
+            break;
+        }
+        case 3:
+            if (!undo_packs.empty()) {
+                redo_packs.push_back(table.undo(std::move(undo_packs.back())));
+                undo_packs.pop_back();
+                redo_texts.push_back(std::move(model));
+                model = std::move(undo_texts.back());
+                undo_texts.pop_back();
+            }
+            break;
+        case 4:
+            if (!redo_packs.empty()) {
+                undo_packs.push_back(table.undo(std::move(redo_packs.back())));
+                redo_packs.pop_back();
+                undo_texts.push_back(std::move(model));
+                model = std::move(redo_texts.back());
+                redo_texts.pop_back();
+            }
+            break;
+        }
+        check_lines(table, model);
+    }
+}
+
+// Non-overlapping occurrences, the way find_all reports them
+std::vector<std::size_t> model_find_all(const std::string& text,
+                                        const std::string& pattern,
+                                        std::size_t from) {
+    std::vector<std::size_t> found;
+    for (std::size_t offset = text.find(pattern, from);
+            offset != std::string::npos;
+            offset = text.find(pattern, offset + pattern.size())) {
+        found.push_back(offset);
+    }
+    return found;
+}
+
+// find and find_all agree with std::string::find on a document of short
+// pieces over a two-letter alphabet: matches span pieces and overlap
+template <typename PieceSequenceT>
+void find_as_model(unsigned seed) {
+    using Table = PieceTable<std::string, std::string, PieceSequenceT>;
+
+    std::mt19937 random{seed};
+    Table table{"abaab"};
+    std::string model = table.to_string();
+    for (int i = 0; i < 200; ++i) {
+        const std::size_t idx = random() % (model.size() + 1);
+        std::string inserted(1 + random() % 3, 'a');
+        for (char& c : inserted) {
+            c = random() % 3 == 0 ? 'b' : 'a';
+        }
+        table.insert_range_at(idx, std::string_view{inserted});
+        model.insert(idx, inserted);
+        if (i % 4 == 0) {
+            const std::size_t at = random() % model.size();
+            table.delete_range_at(at, 1);
+            model.erase(at, 1);
+        }
+    }
+    assert(table.to_string() == model);
+    assert(table.piece_count() > 100);
+
+    const std::string patterns[] = {
+        "", "a", "b", "aa", "aaa", "aba", "abab", "baab", "aaaaa",
+        "bbbbbbbb", model.substr(model.size() / 3, 40), model,
+        model + "a",
+    };
+    for (const std::string& pattern : patterns) {
+        for (std::size_t from = 0; from <= model.size() + 1;
+                from += 1 + random() % 16) {
+            assert(table.find(pattern, from) == model.find(pattern, from));
+            assert(table.find_all(pattern, from)
+                   == (pattern.empty() ? std::vector<std::size_t>{}
+                                       : model_find_all(model, pattern,
+                                                        from)));
+        }
+        assert(table.find(pattern, model.size())
+               == model.find(pattern, model.size()));
+    }
+}
+
+#if __has_include(<sys/uio.h>)
+std::string read_file(int fd) {
+    std::string text;
+    char chunk[4096];
+    assert(::lseek(fd, 0, SEEK_SET) == 0);
+    for (ssize_t n; (n = ::read(fd, chunk, sizeof(chunk))) > 0;) {
+        text.append(chunk, static_cast<std::size_t>(n));
+    }
+    return text;
+}
+#endif
+
+// write_to a stream and to a file give to_string, for a document of more
+// pieces than a single writev takes
+template <typename PieceSequenceT>
+void write_to_as_to_string() {
+    using Table = PieceTable<std::string, std::string, PieceSequenceT>;
+
+    Table table{"original"};
+    std::size_t max_iovecs = 1024;
+#if __has_include(<sys/uio.h>)
+    max_iovecs = static_cast<std::size_t>(
+        std::max(::sysconf(_SC_IOV_MAX), 16L));
+#endif
+    // inserts at the front don't grow the previous piece, every one adds
+    // one, deletes cut some short
+    for (std::size_t i = 0; table.piece_count() < 2 * max_iovecs + 10; ++i) {
+        const char inserted[] = {static_cast<char>('a' + i % 26), '\n'};
+        table.insert_range_at(0, std::string_view{inserted, 2});
+        if (i % 7 == 0) {
+            table.delete_range_at(1, 1);
+        }
+    }
+    const std::string expected = table.to_string();
+
+    std::ostringstream out;
+    table.write_to(out);
+    assert(out.str() == expected);
+
+#if __has_include(<sys/uio.h>)
+    char path[] = "/tmp/piece_table_test_XXXXXX";
+    const int fd = ::mkstemp(path);
+    assert(fd >= 0);
+    ::unlink(path);
+    table.write_to(fd);
+    assert(read_file(fd) == expected);
+    ::close(fd);
+#endif
+}
+
+// Typing right after the previous insert grows its piece, undo and redo
+// of every keystroke still restore the exact text and pieces
+template <typename PieceSequenceT>
+void typing_coalesces() {
+    using Table = PieceTable<std::string, std::string, PieceSequenceT>;
+    using UndoPack = typename Table::UndoPack;
+
+    Table table{"hello world"};
+    std::vector<UndoPack> undo_packs;
+    std::vector<std::string> texts{table.to_string()};
+    std::vector<std::size_t> piece_counts{table.piece_count()};
+    const auto type = [&](std::size_t idx, std::string_view typed) {
+        for (const char c : typed) {
+            undo_packs.push_back(table.insert_at(idx++, c));
+            texts.push_back(table.to_string());
+            piece_counts.push_back(table.piece_count());
+        }
+    };
+
+    type(5, ",");
+    assert(table.piece_count() == 3);
+    type(6, " dear");
+    assert(table.to_string() == "hello, dear world");
+    assert(table.piece_count() == 3);
+
+    // typing elsewhere in between: the append buffer has moved on
+    type(0, "Oh ");
+    assert(table.piece_count() == 4);
+    type(14, "est");
+    assert(table.to_string() == "Oh hello, dearest world");
+    assert(table.piece_count() == 5);
+
+    // typing at the end grows the appended piece as well
+    type(23, "!!");
+    assert(table.to_string() == "Oh hello, dearest world!!");
+    assert(table.piece_count() == 6);
+
+    const auto typed_texts = texts;
+    const auto typed_piece_counts = piece_counts;
+    std::vector<UndoPack> redo_packs;
+    while (!undo_packs.empty()) {
+        redo_packs.push_back(table.undo(std::move(undo_packs.back())));
+        undo_packs.pop_back();
+        texts.pop_back();
+        piece_counts.pop_back();
+        assert(table.to_string() == texts.back());
+        assert(table.piece_count() == piece_counts.back());
+    }
+    assert(table.to_string() == "hello world");
+    assert(table.piece_count() == 1);
+
+    while (!redo_packs.empty()) {
+        undo_packs.push_back(table.undo(std::move(redo_packs.back())));
+        redo_packs.pop_back();
+        texts.push_back(table.to_string());
+        piece_counts.push_back(table.piece_count());
+    }
+    assert(texts == typed_texts);
+    assert(piece_counts == typed_piece_counts);
+
+    // typing after an undo doesn't continue the undone keystroke, whose
+    // text stays in the append buffer
+    redo_packs.push_back(table.undo(std::move(undo_packs.back())));
+    undo_packs.pop_back();
+    table.insert_at(24, '?');
+    assert(table.to_string() == "Oh hello, dearest world!?");
+    assert(table.piece_count() == 7);
+}
+
+}  // namespace
+
+int main() {
+    for (unsigned seed = 1; seed <= 10; ++seed) {
+        apply_edits_as_sequential<std::list<Piece>>(seed);
+        apply_edits_as_sequential<std::vector<Piece>>(seed);
+        apply_edits_as_sequential<PieceTree>(seed);
+        apply_edits_as_sequential<PieceBTree>(seed);
+        line_queries_as_model(seed);
+        find_as_model<std::list<Piece>>(seed);
+        find_as_model<std::vector<Piece>>(seed);
+        find_as_model<PieceTree>(seed);
+        find_as_model<PieceBTree>(seed);
+    }
+    write_to_as_to_string<std::list<Piece>>();
+    write_to_as_to_string<std::vector<Piece>>();
+    write_to_as_to_string<PieceTree>();
+    typing_coalesces<std::list<Piece>>();
+    typing_coalesces<std::vector<Piece>>();
+    typing_coalesces<PieceTree>();
+    typing_coalesces<PieceBTree>();
+    std::puts("piece_table_test: OK");
+}
@@ -0,0 +1,109 @@
+// Checks of UndoRedoTextBuffer's history, assert-based:
+//
+//   g++ -std=c++20 -O1 -g undo_redo_text_buffer_test.cpp && ./a.out
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "../include/chunked_append_buffer.h"
+#include "../include/undo_redo_text_buffer.h"
+
+namespace {
+
+// Text typed and still in the document isn't charged to the history, so
+// a long typing burst under a byte limit stays a single undoable operation
+void long_burst_under_byte_limit() {
+    UndoRedoTextBuffer<std::string> buffer{std::string{"abc"}};
+    buffer.set_history_limit({.max_bytes = std::size_t{1} << 20});
+
+    for (std::size_t i = 0; i < 10'000; ++i) {
+        buffer.insert_at(buffer.size(), static_cast<char>('a' + i % 26));
+    }
+    assert(buffer.undo_count() == 1);
+    assert(buffer.history_bytes() < 10'000 * sizeof(Piece));
+
+    buffer.undo();
+    assert(buffer.to_string() == "abc");
+    buffer.redo();
+    assert(buffer.size() == 10'003);
+}
+
+// Deleted text is only kept by the history, it's charged
+void deleted_text_is_charged() {
+    UndoRedoTextBuffer<std::string> buffer;
+    buffer.append_range(std::string(1000, 'x'));
+    const std::size_t typed_bytes = buffer.history_bytes();
+    assert(typed_bytes < 1000);
+
+    buffer.delete_range_at(100, 500);
+    assert(buffer.history_bytes() >= typed_bytes + 500);
+
+    buffer.undo();
+    assert(buffer.history_bytes() == typed_bytes);
+    buffer.redo();
+    assert(buffer.history_bytes() >= typed_bytes + 500);
+
+    buffer.set_history_limit({.max_bytes = typed_bytes + 499});
+    assert(buffer.undo_count() == 0);
+    assert(buffer.history_bytes() == 0);
+    assert(buffer.to_string() == std::string(500, 'x'));
+}
+
+// A limit set inside a transaction applies on commit, the open
+// transaction isn't forgotten
+void history_limit_set_in_transaction() {
+    UndoRedoTextBuffer<std::string> buffer{std::string{"abc"}};
+    buffer.insert_at(3, 'd');
+    buffer.break_typing_burst();
+    buffer.begin_transaction();
+    buffer.insert_at(0, 'x');
+    buffer.set_history_limit({.max_operations = 0});
+    assert(buffer.undo_count() == 2);
+    buffer.insert_at(0, 'y');
+    buffer.commit_transaction();
+    assert(buffer.undo_count() == 0);
+    assert(buffer.to_string() == "yxabcd");
+
+    buffer.set_history_limit({.max_operations = 1});
+    buffer.begin_transaction();
+    buffer.delete_range_at(0, 2);
+    buffer.set_history_limit({.max_bytes = 0});
+    buffer.delete_range_at(0, 1);
+    buffer.set_history_limit({.max_operations = 1});
+    buffer.commit_transaction();
+    assert(buffer.undo_count() == 1);
+    buffer.undo();
+    assert(buffer.to_string() == "yxabcd");
+}
+
+// Snapshots keep the append buffer they point into alive when edits
+// compact it
+void snapshot_survives_compaction() {
+    UndoRedoTextBuffer<ChunkedAppendBuffer<char>> buffer;
+    buffer.set_history_limit({.max_operations = 1});
+    buffer.append_range(std::string(1000, 'a'));
+    const auto snapshot = buffer.snapshot();
+
+    // forgotten text, compacted every min_compaction_size or more
+    for (std::size_t i = 0; i < 1000; ++i) {
+        buffer.insert_range_at(500, std::string(1000, 'b'));
+        buffer.delete_range_at(500, 1000);
+    }
+    std::string text(snapshot.size(), '\0');
+    snapshot.copy_range(0, snapshot.size(), text);
+    assert(text == std::string(1000, 'a'));
+    assert(buffer.to_string() == text);
+}
+
+}  // namespace
+
+int main() {
+    long_burst_under_byte_limit();
+    deleted_text_is_charged();
+    history_limit_set_in_transaction();
+    snapshot_survives_compaction();
+    std::puts("undo_redo_text_buffer_test: OK");
+}